@@ -1,6 +1,7 @@
 #ifndef BDW_ATTRS_H
 #define BDW_ATTRS_H
 
+#include "gc-config.h"
 #include "gc-attrs.h"
 #include "gc-assert.h"
 
@@ -41,6 +42,8 @@ static inline int gc_allocator_needs_clear(void) {
 }
 
 static inline enum gc_old_generation_check_kind gc_old_generation_check_kind(size_t) {
+  if (GC_GENERATIONAL)
+    return GC_OLD_GENERATION_CHECK_SLOW;
   return GC_OLD_GENERATION_CHECK_NONE;
 }
 static inline uint8_t gc_old_generation_check_alloc_table_bit_pattern(void) {
@@ -48,6 +51,8 @@ static inline uint8_t gc_old_generation_check_alloc_table_bit_pattern(void) {
 }
 
 static inline enum gc_write_barrier_kind gc_write_barrier_kind(size_t) {
+  if (GC_GENERATIONAL)
+    return GC_WRITE_BARRIER_SLOW;
   return GC_WRITE_BARRIER_NONE;
 }
 static inline size_t gc_write_barrier_card_table_alignment(void) {
@@ -56,6 +56,10 @@ GC_API_ void* gc_call_without_gc(struct gc_mutator *mut, void* (*f)(void*),
 GC_API_ void gc_collect(struct gc_mutator *mut,
                         enum gc_collection_kind requested_kind);
 
+GC_API_ uint64_t gc_mutator_allocated_bytes(struct gc_mutator *mut);
+GC_API_ void gc_mutator_set_allocation_quota(struct gc_mutator *mut,
+                                             uint64_t bytes);
+
 static inline void gc_clear_fresh_allocation(struct gc_ref obj,
                                              size_t size) GC_ALWAYS_INLINE;
 static inline void gc_clear_fresh_allocation(struct gc_ref obj,
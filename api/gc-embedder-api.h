@@ -36,6 +36,7 @@ GC_EMBEDDER_API inline void gc_trace_object(struct gc_ref ref,
                                             struct gc_heap *heap,
                                             void *trace_data,
                                             size_t *size) GC_ALWAYS_INLINE;
+GC_EMBEDDER_API inline const char* gc_object_kind_name(struct gc_ref ref);
 
 GC_EMBEDDER_API inline void gc_trace_mutator_roots(struct gc_mutator_roots *roots,
                                                    void (*trace_edge)(struct gc_edge edge,
@@ -61,6 +62,8 @@ GC_EMBEDDER_API inline void gc_atomic_forward_abort(struct gc_atomic_forward *);
 GC_EMBEDDER_API inline size_t gc_atomic_forward_object_size(struct gc_atomic_forward *);
 GC_EMBEDDER_API inline void gc_atomic_forward_commit(struct gc_atomic_forward *,
                                                      struct gc_ref new_ref);
+GC_EMBEDDER_API inline int gc_atomic_forward_install(struct gc_atomic_forward *,
+                                                    struct gc_ref new_ref);
 GC_EMBEDDER_API inline uintptr_t gc_atomic_forward_address(struct gc_atomic_forward *);
 
 
@@ -1,6 +1,8 @@
 #ifndef GC_NULL_EVENT_LISTENER_H
 #define GC_NULL_EVENT_LISTENER_H
 
+#include <stddef.h>
+
 #include "gc-event-listener.h"
 
 static inline void gc_null_event_listener_init(void *data, size_t size) {}
@@ -15,7 +17,9 @@ static inline void gc_null_event_listener_ephemerons_traced(void *data) {}
 static inline void gc_null_event_listener_finalizers_traced(void *data) {}
 static inline void gc_null_event_listener_restarting_mutators(void *data) {}
 
-static inline void* gc_null_event_listener_mutator_added(void *data) {}
+static inline void* gc_null_event_listener_mutator_added(void *data) {
+  return NULL;
+}
 static inline void gc_null_event_listener_mutator_cause_gc(void *mutator_data) {}
 static inline void gc_null_event_listener_mutator_stopping(void *mutator_data) {}
 static inline void gc_null_event_listener_mutator_stopped(void *mutator_data) {}
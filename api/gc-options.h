@@ -15,7 +15,12 @@ enum {
   GC_OPTION_MAXIMUM_HEAP_SIZE,
   GC_OPTION_HEAP_SIZE_MULTIPLIER,
   GC_OPTION_HEAP_EXPANSIVENESS,
-  GC_OPTION_PARALLELISM
+  GC_OPTION_PARALLELISM,
+  GC_OPTION_TRACE_WORKER_IDLE_TIMEOUT,
+  GC_OPTION_REMEMBERED_SET_LIMIT,
+  GC_OPTION_RETENTION_REPORT_INTERVAL,
+  GC_OPTION_PROMOTION_AGE,
+  GC_OPTION_TRACE_WORKLIST_MAX_LOG_SIZE
 };
 
 struct gc_options;
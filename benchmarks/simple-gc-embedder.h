@@ -4,6 +4,9 @@
 #include "simple-roots-types.h"
 #include "gc-config.h"
 #include "gc-embedder-api.h"
+// The benchmarks all report basic stats, so that collectors built with
+// -DGC_STATIC_EVENT_LISTENER=gc_basic_stats can bind to it directly.
+#include "gc-basic-stats.h"
 
 #define GC_EMBEDDER_EPHEMERON_HEADER struct gc_header header;
 #define GC_EMBEDDER_FINALIZER_HEADER struct gc_header header;
@@ -62,6 +65,18 @@ static inline void gc_trace_object(struct gc_ref ref,
 #endif
 }
 
+static inline const char* gc_object_kind_name(struct gc_ref ref) {
+  switch (tag_live_alloc_kind(*tag_word(ref))) {
+#define KIND_NAME(name, Name, NAME)                                     \
+    case ALLOC_KIND_##NAME:                                             \
+      return #Name;
+    FOR_EACH_HEAP_OBJECT_KIND(KIND_NAME)
+#undef KIND_NAME
+  default:
+    return "unknown";
+  }
+}
+
 static inline void visit_roots(struct handle *roots,
                                void (*trace_edge)(struct gc_edge edge,
                                                   struct gc_heap *heap,
@@ -155,7 +170,8 @@ gc_atomic_forward_abort(struct gc_atomic_forward *fwd) {
 
 static inline size_t
 gc_atomic_forward_object_size(struct gc_atomic_forward *fwd) {
-  GC_ASSERT(fwd->state == GC_FORWARDING_STATE_ACQUIRED);
+  GC_ASSERT(fwd->state == GC_FORWARDING_STATE_ACQUIRED
+            || fwd->state == GC_FORWARDING_STATE_NOT_FORWARDED);
   switch (tag_live_alloc_kind(fwd->data)) {
 #define OBJECT_SIZE(name, Name, NAME)                                   \
     case ALLOC_KIND_##NAME:                                             \
@@ -176,6 +192,25 @@ gc_atomic_forward_commit(struct gc_atomic_forward *fwd, struct gc_ref new_ref) {
   fwd->state = GC_FORWARDING_STATE_FORWARDED;
 }
 
+static inline int
+gc_atomic_forward_install(struct gc_atomic_forward *fwd, struct gc_ref new_ref) {
+  GC_ASSERT(fwd->state == GC_FORWARDING_STATE_NOT_FORWARDED);
+  *tag_word(new_ref) = fwd->data;
+  if (atomic_compare_exchange_strong(tag_word(fwd->ref), &fwd->data,
+                                     gc_ref_value(new_ref))) {
+    fwd->state = GC_FORWARDING_STATE_FORWARDED;
+    fwd->data = gc_ref_value(new_ref);
+    return 1;
+  }
+  if (fwd->data == gcobj_busy)
+    fwd->state = GC_FORWARDING_STATE_BUSY;
+  else {
+    GC_ASSERT((fwd->data & gcobj_not_forwarded_bit) == 0);
+    fwd->state = GC_FORWARDING_STATE_FORWARDED;
+  }
+  return 0;
+}
+
 static inline uintptr_t
 gc_atomic_forward_address(struct gc_atomic_forward *fwd) {
   GC_ASSERT(fwd->state == GC_FORWARDING_STATE_FORWARDED);
@@ -39,6 +39,11 @@ GC_CFLAGS_bdw 	   = -DGC_CONSERVATIVE_ROOTS=1 -DGC_CONSERVATIVE_TRACE=1
 GC_IMPL_CFLAGS_bdw = `pkg-config --cflags bdw-gc`
 GC_LIBS_bdw        = `pkg-config --libs bdw-gc`
 
+GC_STEM_generational_bdw       = $(GC_STEM_bdw)
+GC_CFLAGS_generational_bdw     = $(GC_CFLAGS_bdw) -DGC_GENERATIONAL=1
+GC_IMPL_CFLAGS_generational_bdw = $(GC_IMPL_CFLAGS_bdw)
+GC_LIBS_generational_bdw       = $(GC_LIBS_bdw)
+
 GC_STEM_semi       = semi
 GC_CFLAGS_semi     = -DGC_PRECISE_ROOTS=1
 GC_LIBS_semi       = -lm
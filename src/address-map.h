@@ -7,6 +7,7 @@
 
 #include "address-hash.h"
 #include "gc-assert.h"
+#include "hash-group.h"
 
 struct hash_map_entry {
   uintptr_t k;
@@ -15,104 +16,116 @@ struct hash_map_entry {
 
 struct hash_map {
   struct hash_map_entry *data;
+  uint8_t *ctrl;        // control byte per slot; see hash-group.h
   size_t size;    	// total number of slots
   size_t n_items;	// number of items in set
-  uint8_t *bits;        // bitvector indicating set slots
+  size_t n_deleted;     // number of tombstones
 };
 
 static void hash_map_clear(struct hash_map *map) {
-  memset(map->bits, 0, map->size / 8);
+  memset(map->ctrl, HASH_CTRL_EMPTY, map->size);
   map->n_items = 0;
+  map->n_deleted = 0;
 }
   
-// Size must be a power of 2.
+// Size must be a power of 2, and at least one group.
 static void hash_map_init(struct hash_map *map, size_t size) {
+  GC_ASSERT(size >= HASH_GROUP_SIZE);
   map->size = size;
   map->data = malloc(sizeof(struct hash_map_entry) * size);
   if (!map->data) GC_CRASH();
-  map->bits = malloc(size / 8);
-  if (!map->bits) GC_CRASH();
+  map->ctrl = hash_ctrl_allocate(size);
   hash_map_clear(map);
 }
 static void hash_map_destroy(struct hash_map *map) {
   free(map->data);
-  free(map->bits);
+  free(map->ctrl);
 }
 
-static size_t hash_map_slot_index(struct hash_map *map, size_t idx) {
-  return idx & (map->size - 1);
-}
-static struct hash_map_entry* hash_map_slot_entry(struct hash_map *map,
-                                                  size_t idx) {
-  return &map->data[hash_map_slot_index(map, idx)];
-}
-static int hash_map_slot_is_empty(struct hash_map *map, size_t idx) {
-  idx = hash_map_slot_index(map, idx);
-  return (map->bits[idx / 8] & (1 << (idx % 8))) == 0;
-}
-static void hash_map_slot_acquire(struct hash_map *map, size_t idx) {
-  idx = hash_map_slot_index(map, idx);
-  map->bits[idx / 8] |= (1 << (idx % 8));
-  map->n_items++;
-}
-static void hash_map_slot_release(struct hash_map *map, size_t idx) {
-  idx = hash_map_slot_index(map, idx);
-  map->bits[idx / 8] &= ~(1 << (idx % 8));
-  map->n_items--;
-}
-static size_t hash_map_slot_distance(struct hash_map *map, size_t idx) {
-  return hash_map_slot_index(map, idx - hash_map_slot_entry(map, idx)->k);
+static size_t hash_map_group_count(struct hash_map *map) {
+  return map->size / HASH_GROUP_SIZE;
 }
 static int hash_map_should_shrink(struct hash_map *map) {
-  return map->size > 8 && map->n_items <= (map->size >> 3);
+  return map->size > HASH_GROUP_SIZE && map->n_items <= (map->size >> 3);
 }
 static int hash_map_should_grow(struct hash_map *map) {
-  return map->n_items >= map->size - (map->size >> 3);
+  return map->n_items + map->n_deleted >= map->size - (map->size >> 3);
 }
 
-static void hash_map_do_insert(struct hash_map *map, uintptr_t k, uintptr_t v) {
-  size_t displacement = 0;
-  while (!hash_map_slot_is_empty(map, k + displacement)
-         && displacement < hash_map_slot_distance(map, k + displacement))
-    displacement++;
-  while (!hash_map_slot_is_empty(map, k + displacement)
-         && displacement == hash_map_slot_distance(map, k + displacement)) {
-    if (hash_map_slot_entry(map, k + displacement)->k == k) {
-      hash_map_slot_entry(map, k + displacement)->v = v;
-      return;
+// Return the index of the slot holding K, or -1 if there is none.
+static size_t hash_map_find_slot(struct hash_map *map, uintptr_t k) {
+  uint8_t tag = hash_ctrl_tag(k);
+  for (struct hash_probe probe = hash_probe_start(k, hash_map_group_count(map));
+       1;
+       hash_probe_next(&probe)) {
+    size_t offset = hash_probe_offset(&probe);
+    uint8_t *ctrl = map->ctrl + offset;
+    for (hash_group_mask m = hash_group_match(ctrl, tag);
+         m;
+         m = hash_group_mask_rest(m)) {
+      size_t slot = offset + hash_group_mask_first(m);
+      if (map->data[slot].k == k)
+        return slot;
     }
-    displacement++;
+    if (hash_group_match_empty(ctrl))
+      return -1;
   }
-  size_t idx = k + displacement;
-  size_t slots_to_move = 0;
-  while (!hash_map_slot_is_empty(map, idx + slots_to_move))
-    slots_to_move++;
-  hash_map_slot_acquire(map, idx + slots_to_move);
-  while (slots_to_move--)
-    *hash_map_slot_entry(map, idx + slots_to_move + 1) =
-      *hash_map_slot_entry(map, idx + slots_to_move);
-  *hash_map_slot_entry(map, idx) = (struct hash_map_entry){ k, v };
 }
 
-static void hash_map_populate(struct hash_map *dst, struct hash_map *src) {
-  for (size_t i = 0; i < src->size; i++)
-    if (!hash_map_slot_is_empty(src, i))
-      hash_map_do_insert(dst, hash_map_slot_entry(src, i)->k,
-                         hash_map_slot_entry(src, i)->v);
+// Return the index of the first empty or deleted slot in K's probe
+// sequence.
+static size_t hash_map_find_free_slot(struct hash_map *map, uintptr_t k) {
+  for (struct hash_probe probe = hash_probe_start(k, hash_map_group_count(map));
+       1;
+       hash_probe_next(&probe)) {
+    size_t offset = hash_probe_offset(&probe);
+    hash_group_mask m = hash_group_match_empty_or_deleted(map->ctrl + offset);
+    if (m)
+      return offset + hash_group_mask_first(m);
+  }
 }
-static void hash_map_grow(struct hash_map *map) {
+
+static void hash_map_insert_unique(struct hash_map *map, uintptr_t k,
+                                   uintptr_t v) {
+  size_t slot = hash_map_find_free_slot(map, k);
+  if (map->ctrl[slot] == HASH_CTRL_DELETED)
+    map->n_deleted--;
+  map->ctrl[slot] = hash_ctrl_tag(k);
+  map->data[slot] = (struct hash_map_entry){ k, v };
+  map->n_items++;
+}
+
+static void hash_map_do_insert(struct hash_map *map, uintptr_t k, uintptr_t v) {
+  size_t slot = hash_map_find_slot(map, k);
+  if (slot != -1)
+    map->data[slot].v = v;
+  else
+    hash_map_insert_unique(map, k, v);
+}
+
+static void hash_map_rehash(struct hash_map *map, size_t size) {
   struct hash_map fresh;
-  hash_map_init(&fresh, map->size << 1);
-  hash_map_populate(&fresh, map);
+  hash_map_init(&fresh, size);
+  for (size_t offset = 0; offset < map->size; offset += HASH_GROUP_SIZE)
+    for (hash_group_mask m = hash_group_match_full(map->ctrl + offset);
+         m;
+         m = hash_group_mask_rest(m)) {
+      struct hash_map_entry *e = &map->data[offset + hash_group_mask_first(m)];
+      hash_map_insert_unique(&fresh, e->k, e->v);
+    }
   hash_map_destroy(map);
   memcpy(map, &fresh, sizeof(fresh));
 }
+static void hash_map_grow(struct hash_map *map) {
+  // If the table is mostly tombstones, clean them out instead of
+  // doubling the size.
+  if (map->n_deleted >= (map->size >> 2))
+    hash_map_rehash(map, map->size);
+  else
+    hash_map_rehash(map, map->size << 1);
+}
 static void hash_map_shrink(struct hash_map *map) {
-  struct hash_map fresh;
-  hash_map_init(&fresh, map->size >> 1);
-  hash_map_populate(&fresh, map);
-  hash_map_destroy(map);
-  memcpy(map, &fresh, sizeof(fresh));
+  hash_map_rehash(map, map->size >> 1);
 }
 
 static void hash_map_insert(struct hash_map *map, uintptr_t k, uintptr_t v) {
@@ -121,37 +134,29 @@ static void hash_map_insert(struct hash_map *map, uintptr_t k, uintptr_t v) {
   hash_map_do_insert(map, k, v);
 }
 static void hash_map_remove(struct hash_map *map, uintptr_t k) {
-  size_t slot = k;
-  while (!hash_map_slot_is_empty(map, slot) && hash_map_slot_entry(map, slot)->k != k)
-    slot++;
-  if (hash_map_slot_is_empty(map, slot))
+  size_t slot = hash_map_find_slot(map, k);
+  if (slot == -1)
     __builtin_trap();
-  while (!hash_map_slot_is_empty(map, slot + 1)
-         && hash_map_slot_distance(map, slot + 1)) {
-    *hash_map_slot_entry(map, slot) = *hash_map_slot_entry(map, slot + 1);
-    slot++;
+  // Groups are probed as a whole, so if this slot's group has an empty
+  // slot, no probe sequence continues past it, and we can mark this
+  // slot as empty.  Otherwise leave a tombstone.
+  uint8_t *group = map->ctrl + (slot & ~(size_t)(HASH_GROUP_SIZE - 1));
+  if (hash_group_match_empty(group)) {
+    map->ctrl[slot] = HASH_CTRL_EMPTY;
+  } else {
+    map->ctrl[slot] = HASH_CTRL_DELETED;
+    map->n_deleted++;
   }
-  hash_map_slot_release(map, slot);
+  map->n_items--;
   if (hash_map_should_shrink(map))
     hash_map_shrink(map);
 }
 static int hash_map_contains(struct hash_map *map, uintptr_t k) {
-  for (size_t slot = k; !hash_map_slot_is_empty(map, slot); slot++) {
-    if (hash_map_slot_entry(map, slot)->k == k)
-      return 1;
-    if (hash_map_slot_distance(map, slot) < (slot - k))
-      return 0;
-  }
-  return 0;
+  return hash_map_find_slot(map, k) != -1;
 }
 static uintptr_t hash_map_lookup(struct hash_map *map, uintptr_t k, uintptr_t default_) {
-  for (size_t slot = k; !hash_map_slot_is_empty(map, slot); slot++) {
-    if (hash_map_slot_entry(map, slot)->k == k)
-      return hash_map_slot_entry(map, slot)->v;
-    if (hash_map_slot_distance(map, slot) < (slot - k))
-      break;
-  }
-  return default_;
+  size_t slot = hash_map_find_slot(map, k);
+  return slot == -1 ? default_ : map->data[slot].v;
 }
 static inline void hash_map_for_each (struct hash_map *map,
                                       void (*f)(uintptr_t, uintptr_t, void*),
@@ -159,9 +164,13 @@ static inline void hash_map_for_each (struct hash_map *map,
 static inline void hash_map_for_each(struct hash_map *map,
                                      void (*f)(uintptr_t, uintptr_t, void*),
                                      void *data) {
-  for (size_t i = 0; i < map->size; i++)
-    if (!hash_map_slot_is_empty(map, i))
-      f(hash_map_slot_entry(map, i)->k, hash_map_slot_entry(map, i)->v, data);
+  for (size_t offset = 0; offset < map->size; offset += HASH_GROUP_SIZE)
+    for (hash_group_mask m = hash_group_match_full(map->ctrl + offset);
+         m;
+         m = hash_group_mask_rest(m)) {
+      struct hash_map_entry *e = &map->data[offset + hash_group_mask_first(m)];
+      f(e->k, e->v, data);
+    }
 }
   
 struct address_map {
@@ -169,7 +178,7 @@ struct address_map {
 };
 
 static void address_map_init(struct address_map *map) {
-  hash_map_init(&map->hash_map, 8);
+  hash_map_init(&map->hash_map, HASH_GROUP_SIZE);
 }
 static void address_map_destroy(struct address_map *map) {
   hash_map_destroy(&map->hash_map);
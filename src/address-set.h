@@ -7,106 +7,114 @@
 
 #include "address-hash.h"
 #include "gc-assert.h"
+#include "hash-group.h"
 
 struct hash_set {
   uintptr_t *data;
+  uint8_t *ctrl;        // control byte per slot; see hash-group.h
   size_t size;    	// total number of slots
   size_t n_items;	// number of items in set
-  uint8_t *bits;        // bitvector indicating set slots
+  size_t n_deleted;     // number of tombstones
 };
 
 static void hash_set_clear(struct hash_set *set) {
-  memset(set->bits, 0, set->size / 8);
+  memset(set->ctrl, HASH_CTRL_EMPTY, set->size);
   set->n_items = 0;
+  set->n_deleted = 0;
 }
   
-// Size must be a power of 2.
+// Size must be a power of 2, and at least one group.
 static void hash_set_init(struct hash_set *set, size_t size) {
+  GC_ASSERT(size >= HASH_GROUP_SIZE);
   set->size = size;
   set->data = malloc(sizeof(uintptr_t) * size);
   if (!set->data) GC_CRASH();
-  set->bits = malloc(size / 8);
-  if (!set->bits) GC_CRASH();
+  set->ctrl = hash_ctrl_allocate(size);
   hash_set_clear(set);
 }
 static void hash_set_destroy(struct hash_set *set) {
   free(set->data);
-  free(set->bits);
+  free(set->ctrl);
 }
 
-static size_t hash_set_slot_index(struct hash_set *set, size_t idx) {
-  return idx & (set->size - 1);
-}
-static int hash_set_slot_is_empty(struct hash_set *set, size_t idx) {
-  idx = hash_set_slot_index(set, idx);
-  return (set->bits[idx / 8] & (1 << (idx % 8))) == 0;
-}
-static uintptr_t hash_set_slot_ref(struct hash_set *set, size_t idx) {
-  return set->data[hash_set_slot_index(set, idx)];
-}
-static void hash_set_slot_set(struct hash_set *set, size_t idx, uintptr_t v) {
-  set->data[hash_set_slot_index(set, idx)] = v;
-}
-static void hash_set_slot_acquire(struct hash_set *set, size_t idx) {
-  idx = hash_set_slot_index(set, idx);
-  set->bits[idx / 8] |= (1 << (idx % 8));
-  set->n_items++;
-}
-static void hash_set_slot_release(struct hash_set *set, size_t idx) {
-  idx = hash_set_slot_index(set, idx);
-  set->bits[idx / 8] &= ~(1 << (idx % 8));
-  set->n_items--;
-}
-static size_t hash_set_slot_distance(struct hash_set *set, size_t idx) {
-  return hash_set_slot_index(set, idx - hash_set_slot_ref(set, idx));
+static size_t hash_set_group_count(struct hash_set *set) {
+  return set->size / HASH_GROUP_SIZE;
 }
 static int hash_set_should_shrink(struct hash_set *set) {
-  return set->size > 8 && set->n_items <= (set->size >> 3);
+  return set->size > HASH_GROUP_SIZE && set->n_items <= (set->size >> 3);
 }
 static int hash_set_should_grow(struct hash_set *set) {
-  return set->n_items >= set->size - (set->size >> 3);
+  return set->n_items + set->n_deleted >= set->size - (set->size >> 3);
 }
 
-static void hash_set_do_insert(struct hash_set *set, uintptr_t v) {
-  size_t displacement = 0;
-  while (!hash_set_slot_is_empty(set, v + displacement)
-         && displacement < hash_set_slot_distance(set, v + displacement))
-    displacement++;
-  while (!hash_set_slot_is_empty(set, v + displacement)
-         && displacement == hash_set_slot_distance(set, v + displacement)) {
-    if (hash_set_slot_ref(set, v + displacement) == v)
-      return;
-    displacement++;
+// Return the index of the slot holding V, or -1 if there is none.
+static size_t hash_set_find_slot(struct hash_set *set, uintptr_t v) {
+  uint8_t tag = hash_ctrl_tag(v);
+  for (struct hash_probe probe = hash_probe_start(v, hash_set_group_count(set));
+       1;
+       hash_probe_next(&probe)) {
+    size_t offset = hash_probe_offset(&probe);
+    uint8_t *ctrl = set->ctrl + offset;
+    for (hash_group_mask m = hash_group_match(ctrl, tag);
+         m;
+         m = hash_group_mask_rest(m)) {
+      size_t slot = offset + hash_group_mask_first(m);
+      if (set->data[slot] == v)
+        return slot;
+    }
+    if (hash_group_match_empty(ctrl))
+      return -1;
   }
-  size_t idx = v + displacement;
-  size_t slots_to_move = 0;
-  while (!hash_set_slot_is_empty(set, idx + slots_to_move))
-    slots_to_move++;
-  hash_set_slot_acquire(set, idx + slots_to_move);
-  while (slots_to_move--)
-    hash_set_slot_set(set, idx + slots_to_move + 1,
-                      hash_set_slot_ref(set, idx + slots_to_move));
-  hash_set_slot_set(set, idx, v);
 }
 
-static void hash_set_populate(struct hash_set *dst, struct hash_set *src) {
-  for (size_t i = 0; i < src->size; i++)
-    if (!hash_set_slot_is_empty(src, i))
-      hash_set_do_insert(dst, hash_set_slot_ref(src, i));
+// Return the index of the first empty or deleted slot in V's probe
+// sequence.
+static size_t hash_set_find_free_slot(struct hash_set *set, uintptr_t v) {
+  for (struct hash_probe probe = hash_probe_start(v, hash_set_group_count(set));
+       1;
+       hash_probe_next(&probe)) {
+    size_t offset = hash_probe_offset(&probe);
+    hash_group_mask m = hash_group_match_empty_or_deleted(set->ctrl + offset);
+    if (m)
+      return offset + hash_group_mask_first(m);
+  }
 }
-static void hash_set_grow(struct hash_set *set) {
+
+static void hash_set_insert_unique(struct hash_set *set, uintptr_t v) {
+  size_t slot = hash_set_find_free_slot(set, v);
+  if (set->ctrl[slot] == HASH_CTRL_DELETED)
+    set->n_deleted--;
+  set->ctrl[slot] = hash_ctrl_tag(v);
+  set->data[slot] = v;
+  set->n_items++;
+}
+
+static void hash_set_do_insert(struct hash_set *set, uintptr_t v) {
+  if (hash_set_find_slot(set, v) == -1)
+    hash_set_insert_unique(set, v);
+}
+
+static void hash_set_rehash(struct hash_set *set, size_t size) {
   struct hash_set fresh;
-  hash_set_init(&fresh, set->size << 1);
-  hash_set_populate(&fresh, set);
+  hash_set_init(&fresh, size);
+  for (size_t offset = 0; offset < set->size; offset += HASH_GROUP_SIZE)
+    for (hash_group_mask m = hash_group_match_full(set->ctrl + offset);
+         m;
+         m = hash_group_mask_rest(m))
+      hash_set_insert_unique(&fresh, set->data[offset + hash_group_mask_first(m)]);
   hash_set_destroy(set);
   memcpy(set, &fresh, sizeof(fresh));
 }
+static void hash_set_grow(struct hash_set *set) {
+  // If the table is mostly tombstones, clean them out instead of
+  // doubling the size.
+  if (set->n_deleted >= (set->size >> 2))
+    hash_set_rehash(set, set->size);
+  else
+    hash_set_rehash(set, set->size << 1);
+}
 static void hash_set_shrink(struct hash_set *set) {
-  struct hash_set fresh;
-  hash_set_init(&fresh, set->size >> 1);
-  hash_set_populate(&fresh, set);
-  hash_set_destroy(set);
-  memcpy(set, &fresh, sizeof(fresh));
+  hash_set_rehash(set, set->size >> 1);
 }
 
 static void hash_set_insert(struct hash_set *set, uintptr_t v) {
@@ -115,37 +123,44 @@ static void hash_set_insert(struct hash_set *set, uintptr_t v) {
   hash_set_do_insert(set, v);
 }
 
+static void hash_set_populate(struct hash_set *dst, struct hash_set *src) {
+  for (size_t offset = 0; offset < src->size; offset += HASH_GROUP_SIZE)
+    for (hash_group_mask m = hash_group_match_full(src->ctrl + offset);
+         m;
+         m = hash_group_mask_rest(m))
+      hash_set_insert(dst, src->data[offset + hash_group_mask_first(m)]);
+}
+
 static void hash_set_remove(struct hash_set *set, uintptr_t v) {
-  size_t slot = v;
-  while (!hash_set_slot_is_empty(set, slot) && hash_set_slot_ref(set, slot) != v)
-    slot++;
-  if (hash_set_slot_is_empty(set, slot))
+  size_t slot = hash_set_find_slot(set, v);
+  if (slot == -1)
     __builtin_trap();
-  while (!hash_set_slot_is_empty(set, slot + 1)
-         && hash_set_slot_distance(set, slot + 1)) {
-    hash_set_slot_set(set, slot, hash_set_slot_ref(set, slot + 1));
-    slot++;
+  // Groups are probed as a whole, so if this slot's group has an empty
+  // slot, no probe sequence continues past it, and we can mark this
+  // slot as empty.  Otherwise leave a tombstone.
+  uint8_t *group = set->ctrl + (slot & ~(size_t)(HASH_GROUP_SIZE - 1));
+  if (hash_group_match_empty(group)) {
+    set->ctrl[slot] = HASH_CTRL_EMPTY;
+  } else {
+    set->ctrl[slot] = HASH_CTRL_DELETED;
+    set->n_deleted++;
   }
-  hash_set_slot_release(set, slot);
+  set->n_items--;
   if (hash_set_should_shrink(set))
     hash_set_shrink(set);
 }
 static int hash_set_contains(struct hash_set *set, uintptr_t v) {
-  for (size_t slot = v; !hash_set_slot_is_empty(set, slot); slot++) {
-    if (hash_set_slot_ref(set, slot) == v)
-      return 1;
-    if (hash_set_slot_distance(set, slot) < (slot - v))
-      return 0;
-  }
-  return 0;
+  return hash_set_find_slot(set, v) != -1;
 }
 static inline void hash_set_find(struct hash_set *set,
                                  int (*f)(uintptr_t, void*), void *data) __attribute__((always_inline));
 static inline void hash_set_find(struct hash_set *set,
                                  int (*f)(uintptr_t, void*), void *data) {
-  for (size_t i = 0; i < set->size; i++)
-    if (!hash_set_slot_is_empty(set, i))
-      if (f(hash_set_slot_ref(set, i), data))
+  for (size_t offset = 0; offset < set->size; offset += HASH_GROUP_SIZE)
+    for (hash_group_mask m = hash_group_match_full(set->ctrl + offset);
+         m;
+         m = hash_group_mask_rest(m))
+      if (f(set->data[offset + hash_group_mask_first(m)], data))
         return;
 }
   
@@ -154,7 +169,7 @@ struct address_set {
 };
 
 static void address_set_init(struct address_set *set) {
-  hash_set_init(&set->hash_set, 8);
+  hash_set_init(&set->hash_set, HASH_GROUP_SIZE);
 }
 static void address_set_destroy(struct address_set *set) {
   hash_set_destroy(&set->hash_set);
@@ -172,6 +187,9 @@ static void address_set_remove(struct address_set *set, uintptr_t addr) {
 static int address_set_contains(struct address_set *set, uintptr_t addr) {
   return hash_set_contains(&set->hash_set, hash_address(addr));
 }
+static size_t address_set_size(struct address_set *set) {
+  return set->hash_set.n_items;
+}
 static void address_set_union(struct address_set *set, struct address_set *other) {
   while (set->hash_set.size < other->hash_set.size)
     hash_set_grow(&set->hash_set);
@@ -70,10 +70,13 @@ struct gc_mutator {
 };
 
 struct gc_heap *__the_bdw_gc_heap;
-#define HEAP_EVENT(event, ...)                                    \
-  __the_bdw_gc_heap->event_listener.event(__the_bdw_gc_heap->event_listener_data, ##__VA_ARGS__)
-#define MUTATOR_EVENT(mut, event, ...)                                  \
-  __the_bdw_gc_heap->event_listener.event(mut->event_listener_data, ##__VA_ARGS__)
+#define HEAP_EVENT(event, ...)                                          \
+  GC_HEAP_EVENT(__the_bdw_gc_heap->event_listener,                      \
+                __the_bdw_gc_heap->event_listener_data,                 \
+                event, ##__VA_ARGS__)
+#define MUTATOR_EVENT(mut, event)                                       \
+  GC_MUTATOR_EVENT(__the_bdw_gc_heap->event_listener, (mut),            \
+                   (mut)->event_listener_data, event)
 
 static inline size_t gc_inline_bytes_to_freelist_index(size_t bytes) {
   return (bytes - 1U) / GC_INLINE_GRANULE_BYTES;
@@ -92,6 +95,23 @@ uintptr_t gc_small_object_nursery_high_address(struct gc_heap *heap) {
   GC_CRASH();
 }
 
+uint64_t gc_mutator_allocated_bytes(struct gc_mutator *mut) {
+  // Per-mutator allocation accounting is not implemented.
+  return 0;
+}
+void gc_mutator_set_allocation_quota(struct gc_mutator *mut, uint64_t bytes) {
+}
+
+// In generational mode, libgc uses the mark bits from the previous
+// collection as sticky "old" bits, and a minor collection only rescans
+// old objects that are on pages which have been dirtied since.  We use
+// libgc's manual virtual dirty bit API, so anything that stores a
+// pointer into a GC-managed object has to record the dirty page.
+static inline void dirty_page(const void *addr) {
+  if (GC_GENERATIONAL)
+    GC_end_stubborn_change(addr);
+}
+
 // The values of these must match the internal POINTERLESS and NORMAL
 // definitions in libgc, for which unfortunately there are no external
 // definitions.  Alack.
@@ -121,6 +141,7 @@ allocate_small(void **freelist, size_t idx, enum gc_inline_kind kind) {
 
 void* gc_allocate_slow(struct gc_mutator *mut, size_t size) {
   GC_ASSERT(size != 0);
+  GC_PROBE(allocate_slow, mut, size);
   if (size <= gc_allocator_large_threshold()) {
     size_t idx = gc_inline_bytes_to_freelist_index(size);
     return allocate_small(&mut->freelists[idx], idx, GC_INLINE_KIND_NORMAL);
@@ -145,7 +166,12 @@ void gc_collect(struct gc_mutator *mut,
                 enum gc_collection_kind requested_kind) {
   switch (requested_kind) {
   case GC_COLLECTION_MINOR:
-    GC_collect_a_little();
+    // In generational mode, this runs a partial collection to
+    // completion, as incremental marking is off.
+    if (GC_GENERATIONAL)
+      GC_start_incremental_collection();
+    else
+      GC_collect_a_little();
     break;
   case GC_COLLECTION_ANY:
   case GC_COLLECTION_MAJOR:
@@ -161,12 +187,19 @@ void gc_collect(struct gc_mutator *mut,
 
 int gc_object_is_old_generation_slow(struct gc_mutator *mut,
                                      struct gc_ref obj) {
+  // In generational mode, an object is old if a previous collection
+  // marked it.  Mark bits only change while mutators are stopped.
+  if (GC_GENERATIONAL)
+    return GC_is_marked(gc_ref_heap_object(obj));
   return 0;
 }
 
 void gc_write_barrier_slow(struct gc_mutator *mut, struct gc_ref obj,
                            size_t obj_size, struct gc_edge edge,
                            struct gc_ref new_val) {
+  // Dirty the page holding the field rather than the page holding the
+  // start of the object, as large objects span multiple pages.
+  dirty_page(gc_edge_loc(edge));
 }
 
 int* gc_safepoint_flag_loc(struct gc_mutator *mut) { GC_CRASH(); }
@@ -187,6 +220,51 @@ static void bdw_mark_edge(struct gc_edge edge, struct gc_heap *heap,
                                             NULL);
 }
 
+// In generational mode, a minor collection only rescans old objects on
+// dirty pages, so the heap and mutator objects would only have their
+// mark procedures run if something had dirtied them since the last
+// collection.  The precise roots that those procedures trace, and the
+// mutators' freelists, change without any write barrier, so instead we
+// push those slots on every collection, as extra roots that libgc scans
+// conservatively.
+//
+// Objects on a freelist survive the collection, so they are old when
+// the mutator takes them off the list; but the embedder initializes
+// fresh objects without a write barrier.  Therefore we also dirty the
+// pages of all freelist objects.  This happens after libgc has read
+// the dirty bits for the current collection, so it is the next
+// collection that rescans them.  The cost is proportional to the
+// length of the freelists, whose objects the collection marks anyway.
+static GC_push_other_roots_proc push_other_roots_chain;
+
+static void bdw_push_root_edge(struct gc_edge edge, struct gc_heap *heap,
+                               void *visit_data) {
+  void **loc = (void **) gc_edge_loc(edge);
+  GC_push_all(loc, loc + 1);
+}
+
+static void push_generational_roots(void) {
+  if (push_other_roots_chain)
+    push_other_roots_chain();
+
+  // The world is stopped, so the mutator list is stable.
+  struct gc_heap *heap = __the_bdw_gc_heap;
+  if (!heap)
+    return;
+  if (heap->roots)
+    gc_trace_heap_roots(heap->roots, bdw_push_root_edge, heap, NULL);
+  gc_visit_finalizer_roots(heap->finalizer_state, bdw_push_root_edge, heap,
+                           NULL);
+  for (struct gc_mutator *mut = heap->mutators; mut; mut = mut->next) {
+    if (mut->roots)
+      gc_trace_mutator_roots(mut->roots, bdw_push_root_edge, heap, NULL);
+    GC_push_all(mut->freelists, mut->freelists + GC_INLINE_FREELIST_COUNT);
+    for (size_t i = 0; i < GC_INLINE_FREELIST_COUNT; i++)
+      for (void **obj = mut->freelists[i]; obj; obj = *obj)
+        dirty_page(obj);
+  }
+}
+
 static int heap_gc_kind;
 static int mutator_gc_kind;
 static int ephemeron_gc_kind;
@@ -213,6 +291,7 @@ unsigned gc_heap_ephemeron_trace_epoch(struct gc_heap *heap) {
 void gc_ephemeron_init(struct gc_mutator *mut, struct gc_ephemeron *ephemeron,
                        struct gc_ref key, struct gc_ref value) {
   gc_ephemeron_init_internal(mut->heap, ephemeron, key, value);
+  dirty_page(ephemeron);
   if (GC_base((void*)gc_ref_value(key))) {
     struct gc_ref *loc = gc_edge_loc(gc_ephemeron_key_edge(ephemeron));
     GC_register_disappearing_link((void**)loc);
@@ -242,6 +321,7 @@ void gc_finalizer_attach(struct gc_mutator *mut, struct gc_finalizer *finalizer,
   void *prev_data = NULL;
   gc_finalizer_init_internal(finalizer, object, closure);
   gc_finalizer_externally_activated(finalizer);
+  dirty_page(finalizer);
   GC_register_finalizer_no_order(gc_ref_heap_object(object), finalize_object,
                                  finalizer, &prev, &prev_data);
   // FIXME: Allow multiple finalizers per object.
@@ -394,6 +474,7 @@ static inline struct gc_mutator *add_mutator(struct gc_heap *heap) {
   if (ret->next)
     ret->next->prev = &ret->next;
   heap->mutators = ret;
+  dirty_page(&heap->mutators);
   pthread_mutex_unlock(&heap->lock);
 
   return ret;
@@ -528,6 +609,20 @@ int gc_init(const struct gc_options *options, struct gc_stack_addr *stack_base,
   snprintf(markers, sizeof(markers), "%d", options->common.parallelism);
   setenv("GC_MARKERS", markers, 1);
   GC_init();
+  if (GC_GENERATIONAL) {
+    // Ask for generational collection but not incremental marking, and
+    // tell libgc that we will report dirty pages from the write
+    // barrier, instead of having it use mprotect or /proc.
+    GC_set_manual_vdb_allowed(1);
+    GC_set_time_limit(GC_TIME_UNLIMITED);
+    GC_enable_incremental();
+    if (!GC_is_incremental_mode()) {
+      fprintf(stderr, "failed to enable generational mode in bdw-gc\n");
+      return 0;
+    }
+    push_other_roots_chain = GC_get_push_other_roots();
+    GC_set_push_other_roots(push_generational_roots);
+  }
   size_t current_heap_size = GC_get_heap_size();
   if (options->common.heap_size > current_heap_size)
     GC_expand_hp(options->common.heap_size - current_heap_size);
@@ -582,6 +677,7 @@ void gc_finish_for_thread(struct gc_mutator *mut) {
   pthread_mutex_lock(&mut->heap->lock);
   MUTATOR_EVENT(mut, mutator_removed);
   *mut->prev = mut->next;
+  dirty_page(mut->prev);
   if (mut->next)
     mut->next->prev = mut->prev;
   pthread_mutex_unlock(&mut->heap->lock);
@@ -595,6 +691,8 @@ void* gc_call_without_gc(struct gc_mutator *mut,
   return GC_do_blocking(f, data);
 }
 
+// In generational mode, push_generational_roots re-traces these roots
+// on every collection.
 void gc_mutator_set_roots(struct gc_mutator *mut,
                           struct gc_mutator_roots *roots) {
   mut->roots = roots;
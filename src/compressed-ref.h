@@ -0,0 +1,101 @@
+#ifndef COMPRESSED_REF_H
+#define COMPRESSED_REF_H
+
+#include <stdint.h>
+
+#include "extents.h"
+#include "gc-assert.h"
+#include "gc-ref.h"
+
+// Trace worklists hold many references, and they are touched twice per
+// traced object: once on push, and once on pop.  If most traced objects
+// lie within a bounded window of the address space, we can halve that
+// memory traffic on 64-bit systems by storing a 32-bit granule offset
+// from the window base instead of a full pointer.  With 16-byte
+// granules, a window spans 64 GB.
+//
+// The zero offset is reserved to represent the null reference, so the
+// base of the window is one granule below the lowest address it covers.
+// References outside the window, or not aligned to a granule, cannot be
+// compressed; callers need a fallback representation for them.
+
+struct compressed_ref {
+  uint32_t offset;
+};
+
+struct ref_compressor {
+  uintptr_t base;
+  uintptr_t span;
+  unsigned granule_size_log2;
+};
+
+static inline struct compressed_ref
+compressed_ref(uint32_t offset) {
+  return (struct compressed_ref){ offset };
+}
+
+static inline struct compressed_ref
+compressed_ref_null(void) {
+  return compressed_ref(0);
+}
+
+static inline int
+compressed_ref_is_null(struct compressed_ref ref) {
+  return ref.offset == 0;
+}
+
+// The largest window that 32-bit offsets of GRANULE_SIZE granules can
+// span.
+static inline uintptr_t
+ref_compressor_max_span(size_t granule_size) {
+  if (sizeof(uintptr_t) <= sizeof(uint32_t))
+    return UINTPTR_MAX;
+  return ((uintptr_t)UINT32_MAX) * granule_size;
+}
+
+static inline void
+ref_compressor_reset(struct ref_compressor *c) {
+  // A zero-length window; nothing is compressible.
+  c->base = 0;
+  c->span = 0;
+  c->granule_size_log2 = 0;
+}
+
+static inline void
+ref_compressor_init(struct ref_compressor *c, struct extent_range range,
+                    size_t granule_size) {
+  GC_ASSERT(granule_size);
+  GC_ASSERT_EQ(granule_size & (granule_size - 1), 0);
+  ref_compressor_reset(c);
+  if (range.hi_addr <= range.lo_addr || range.lo_addr < granule_size)
+    return;
+  c->granule_size_log2 = __builtin_ctzll(granule_size);
+  c->base = range.lo_addr - granule_size;
+  c->span = range.hi_addr - c->base;
+  if (c->span > ref_compressor_max_span(granule_size))
+    c->span = ref_compressor_max_span(granule_size);
+}
+
+static inline int
+ref_compressor_can_compress(const struct ref_compressor *c,
+                            struct gc_ref ref) {
+  uintptr_t offset = gc_ref_value(ref) - c->base;
+  uintptr_t granule_mask = (((uintptr_t)1) << c->granule_size_log2) - 1;
+  return offset && offset < c->span && (offset & granule_mask) == 0;
+}
+
+static inline struct compressed_ref
+ref_compressor_compress(const struct ref_compressor *c, struct gc_ref ref) {
+  GC_ASSERT(ref_compressor_can_compress(c, ref));
+  return compressed_ref((gc_ref_value(ref) - c->base) >> c->granule_size_log2);
+}
+
+static inline struct gc_ref
+ref_compressor_decompress(const struct ref_compressor *c,
+                          struct compressed_ref ref) {
+  if (compressed_ref_is_null(ref))
+    return gc_ref_null();
+  return gc_ref(c->base + (((uintptr_t)ref.offset) << c->granule_size_log2));
+}
+
+#endif // COMPRESSED_REF_H
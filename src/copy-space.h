@@ -18,7 +18,6 @@
 #include "gc-inline.h"
 #include "gc-lock.h"
 #include "gc-platform.h"
-#include "spin.h"
 
 // A copy space: a block-structured space that traces via evacuation.
 
@@ -160,10 +159,18 @@ enum copy_space_forward_result {
   COPY_SPACE_FORWARD_FAILED,
 };
 
+// Objects at least this large may be evacuated into an overflow region
+// instead of finishing off the current block; see
+// copy_space_evacuation_allocate.
+#define COPY_SPACE_MEDIUM_OBJECT_THRESHOLD 256
+
 struct copy_space_allocator {
   uintptr_t hp;
   uintptr_t limit;
   struct copy_space_block *block;
+  uintptr_t overflow_hp;
+  uintptr_t overflow_limit;
+  struct copy_space_block *overflow_block;
 };
 
 static struct gc_lock
@@ -330,6 +337,11 @@ copy_space_contains_address(struct copy_space *space, uintptr_t addr) {
   return extents_contain_addr(space->extents, addr);
 }
 
+static inline struct extent_range
+copy_space_bounds(struct copy_space *space) {
+  return extents_bounds(space->extents);
+}
+
 static inline int
 copy_space_contains(struct copy_space *space, struct gc_ref ref) {
   return copy_space_contains_address(space, gc_ref_value(ref));
@@ -409,23 +421,30 @@ copy_space_allocator_acquire_block(struct copy_space_allocator *alloc,
   return 0;
 }
 
-static int
-copy_space_allocator_acquire_empty_block(struct copy_space_allocator *alloc,
-                                         struct copy_space *space) {
+static struct copy_space_block*
+copy_space_acquire_empty_block(struct copy_space *space) {
   struct gc_lock lock = copy_space_lock(space);
   struct copy_space_block *block = copy_space_pop_empty_block(space, &lock);
   gc_lock_release(&lock);
-  if (copy_space_allocator_acquire_block(alloc, block, space->active_region)) {
+  if (block) {
     block->in_core = 1;
     if (block->all_zeroes[space->active_region]) {
       block->all_zeroes[space->active_region] = 0;
     } else {
-      memset((char*)alloc->hp, 0, COPY_SPACE_REGION_SIZE);
-      copy_space_clear_field_logged_bits_for_region(space, (void*)alloc->hp);
+      struct copy_space_region *region =
+        &copy_space_block_payload(block)->regions[space->active_region];
+      memset(region, 0, COPY_SPACE_REGION_SIZE);
+      copy_space_clear_field_logged_bits_for_region(space, region);
     }
-    return 1;
   }
-  return 0;
+  return block;
+}
+
+static int
+copy_space_allocator_acquire_empty_block(struct copy_space_allocator *alloc,
+                                         struct copy_space *space) {
+  struct copy_space_block *block = copy_space_acquire_empty_block(space);
+  return copy_space_allocator_acquire_block(alloc, block, space->active_region);
 }
 
 static int
@@ -458,29 +477,45 @@ copy_space_allocator_release_full_block(struct copy_space_allocator *alloc,
 }
 
 static void
-copy_space_allocator_release_partly_full_block(struct copy_space_allocator *alloc,
-                                               struct copy_space *space) {
-  size_t allocated = alloc->hp & (COPY_SPACE_REGION_SIZE - 1);
+copy_space_release_partly_full_block(struct copy_space *space,
+                                     struct copy_space_block *block,
+                                     uintptr_t hp) {
+  size_t allocated = hp & (COPY_SPACE_REGION_SIZE - 1);
   if (allocated) {
     atomic_fetch_add_explicit(&space->allocated_bytes,
-                              allocated - alloc->block->allocated,
+                              allocated - block->allocated,
                               memory_order_relaxed);
-    alloc->block->allocated = allocated;
+    block->allocated = allocated;
     struct gc_lock lock = copy_space_lock(space);
-    copy_space_push_partly_full_block(space, alloc->block, &lock);
+    copy_space_push_partly_full_block(space, block, &lock);
     gc_lock_release(&lock);
   } else {
     // In this case, hp was bumped all the way to the limit, in which
     // case allocated wraps to 0; the block is full.
     atomic_fetch_add_explicit(&space->allocated_bytes,
-                              COPY_SPACE_REGION_SIZE - alloc->block->allocated,
+                              COPY_SPACE_REGION_SIZE - block->allocated,
                               memory_order_relaxed);
-    copy_space_push_full_block(space, alloc->block);
+    copy_space_push_full_block(space, block);
   }
+}
+
+static void
+copy_space_allocator_release_partly_full_block(struct copy_space_allocator *alloc,
+                                               struct copy_space *space) {
+  copy_space_release_partly_full_block(space, alloc->block, alloc->hp);
   alloc->hp = alloc->limit = 0;
   alloc->block = NULL;
 }
 
+static void
+copy_space_allocator_release_overflow_block(struct copy_space_allocator *alloc,
+                                            struct copy_space *space) {
+  copy_space_release_partly_full_block(space, alloc->overflow_block,
+                                       alloc->overflow_hp);
+  alloc->overflow_hp = alloc->overflow_limit = 0;
+  alloc->overflow_block = NULL;
+}
+
 static inline struct gc_ref
 copy_space_allocate(struct copy_space_allocator *alloc,
                     struct copy_space *space,
@@ -510,6 +545,60 @@ done:
   return ret;
 }
 
+// When evacuating a medium-sized object that doesn't fit in the current
+// block, releasing the block as full would waste its tail.  Instead,
+// bump-allocate such objects in a separate overflow region taken from
+// an empty block, leaving the current block to small objects.  When the
+// overflow region is exhausted, its tail goes back on the partly-full
+// list, where any worker can pick it up.  If there are no empty blocks,
+// fall back to copy_space_allocate.
+static inline struct gc_ref
+copy_space_evacuation_allocate(struct copy_space_allocator *alloc,
+                               struct copy_space *space,
+                               size_t size) {
+  GC_ASSERT(size > 0);
+  GC_ASSERT(size <= gc_allocator_large_threshold());
+  size = align_up(size, gc_allocator_small_granule_size());
+
+  if (size < COPY_SPACE_MEDIUM_OBJECT_THRESHOLD
+      || alloc->hp + size <= alloc->limit)
+    return copy_space_allocate(alloc, space, size);
+
+  if (alloc->overflow_hp + size > alloc->overflow_limit) {
+    if (alloc->overflow_block)
+      copy_space_allocator_release_overflow_block(alloc, space);
+    struct copy_space_block *block = copy_space_acquire_empty_block(space);
+    if (!block)
+      return copy_space_allocate(alloc, space, size);
+    struct copy_space_region *region =
+      &copy_space_block_payload(block)->regions[space->active_region];
+    alloc->overflow_block = block;
+    alloc->overflow_hp = (uintptr_t)&region[0];
+    alloc->overflow_limit = (uintptr_t)&region[1];
+  }
+
+  struct gc_ref ret = gc_ref(alloc->overflow_hp);
+  alloc->overflow_hp += size;
+  return ret;
+}
+
+// Give back the object that ALLOC just allocated, which must be the
+// last allocation from its region.  The memory is cleared again, as the
+// rest of the block may be handed to a mutator, which expects zeroed
+// memory.
+static inline void
+copy_space_allocator_unallocate(struct copy_space_allocator *alloc,
+                                struct gc_ref ref, size_t size) {
+  size = align_up(size, gc_allocator_small_granule_size());
+  memset(gc_ref_heap_object(ref), 0, size);
+  if (alloc->overflow_hp == gc_ref_value(ref) + size) {
+    alloc->overflow_hp = gc_ref_value(ref);
+  } else {
+    GC_ASSERT_EQ(alloc->hp, gc_ref_value(ref) + size);
+    alloc->hp = gc_ref_value(ref);
+  }
+}
+
 static struct copy_space_block*
 copy_space_append_block_lists(struct copy_space_block *head,
                               struct copy_space_block *tail) {
@@ -548,6 +637,8 @@ copy_space_allocator_finish(struct copy_space_allocator *alloc,
                             struct copy_space *space) {
   if (alloc->block)
     copy_space_allocator_release_partly_full_block(alloc, space);
+  if (alloc->overflow_block)
+    copy_space_allocator_release_overflow_block(alloc, space);
 }
 
 static void
@@ -603,46 +694,34 @@ copy_space_forward_atomic(struct copy_space *space, struct gc_edge edge,
                           struct copy_space_allocator *alloc) {
   struct gc_atomic_forward fwd = gc_atomic_forward_begin(old_ref);
 
-retry:
-  if (fwd.state == GC_FORWARDING_STATE_NOT_FORWARDED)
-    gc_atomic_forward_acquire(&fwd);
-
-  switch (fwd.state) {
-  case GC_FORWARDING_STATE_NOT_FORWARDED:
-  default:
-    // Impossible.
-    GC_CRASH();
-  case GC_FORWARDING_STATE_ACQUIRED: {
-    // We claimed the object successfully; evacuating is up to us.
+  if (fwd.state == GC_FORWARDING_STATE_NOT_FORWARDED) {
+    // Copy the object speculatively, then try to install the forwarding
+    // pointer.  Only an object's forwarding word changes while it is
+    // being evacuated, so if we win the race, the copy is good.  If we
+    // lose, give back the copy.  Either way, no worker ever has to wait
+    // for another.
     size_t bytes = gc_atomic_forward_object_size(&fwd);
-    struct gc_ref new_ref = copy_space_allocate(alloc, space, bytes);
-    if (gc_ref_is_null(new_ref)) {
-      gc_atomic_forward_abort(&fwd);
+    struct gc_ref new_ref = copy_space_evacuation_allocate(alloc, space, bytes);
+    if (gc_ref_is_null(new_ref))
       return COPY_SPACE_FORWARD_FAILED;
-    }
-    // Copy object contents before committing, as we don't know what
-    // part of the object (if any) will be overwritten by the
-    // commit.
     memcpy(gc_ref_heap_object(new_ref), gc_ref_heap_object(old_ref), bytes);
-    gc_atomic_forward_commit(&fwd, new_ref);
-    gc_edge_update(edge, new_ref);
-    return COPY_SPACE_FORWARD_EVACUATED;
-  }
-  case GC_FORWARDING_STATE_BUSY:
-    // Someone else claimed this object first.  Spin until new address
-    // known, or evacuation aborts.
-    for (size_t spin_count = 0;; spin_count++) {
-      if (gc_atomic_forward_retry_busy(&fwd))
-        goto retry;
-      yield_for_spin(spin_count);
+    if (gc_atomic_forward_install(&fwd, new_ref)) {
+      gc_edge_update(edge, new_ref);
+      return COPY_SPACE_FORWARD_EVACUATED;
     }
-    GC_CRASH(); // Unreachable.
+    copy_space_allocator_unallocate(alloc, new_ref, bytes);
+  }
+
+  switch (fwd.state) {
   case GC_FORWARDING_STATE_FORWARDED:
     // The object has been evacuated already.  Update the edge;
     // whoever forwarded the object will make sure it's eventually
     // traced.
     gc_edge_update(edge, gc_ref(gc_atomic_forward_address(&fwd)));
     return COPY_SPACE_FORWARD_UPDATED;
+  default:
+    // Impossible: nothing acquires objects in a copy space.
+    GC_CRASH();
   }
 }
 
@@ -651,19 +730,9 @@ copy_space_forward_if_traced_atomic(struct copy_space *space,
                                     struct gc_edge edge,
                                     struct gc_ref old_ref) {
   struct gc_atomic_forward fwd = gc_atomic_forward_begin(old_ref);
-retry:
   switch (fwd.state) {
   case GC_FORWARDING_STATE_NOT_FORWARDED:
     return 0;
-  case GC_FORWARDING_STATE_BUSY:
-    // Someone else claimed this object first.  Spin until new address
-    // known.
-    for (size_t spin_count = 0;; spin_count++) {
-      if (gc_atomic_forward_retry_busy(&fwd))
-        goto retry;
-      yield_for_spin(spin_count);
-    }
-    GC_CRASH(); // Unreachable.
   case GC_FORWARDING_STATE_FORWARDED:
     gc_edge_update(edge, gc_ref(gc_atomic_forward_address(&fwd)));
     return 1;
@@ -683,7 +752,7 @@ copy_space_forward_nonatomic(struct copy_space *space, struct gc_edge edge,
   } else {
     size_t size;
     gc_trace_object(old_ref, NULL, NULL, NULL, &size);
-    struct gc_ref new_ref = copy_space_allocate(alloc, space, size);
+    struct gc_ref new_ref = copy_space_evacuation_allocate(alloc, space, size);
     if (gc_ref_is_null(new_ref))
       return COPY_SPACE_FORWARD_FAILED;
     memcpy(gc_ref_heap_object(new_ref), gc_ref_heap_object(old_ref), size);
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "gc-assert.h"
 
@@ -35,6 +36,24 @@ extents_contain_addr(struct extents *extents, uintptr_t addr) {
   return 0;
 }
 
+static inline struct extent_range
+extents_bounds(struct extents *extents) {
+  if (!extents->size)
+    return (struct extent_range){ 0, 0 };
+  return (struct extent_range){ extents->ranges[0].lo_addr,
+                                extents->ranges[extents->size - 1].hi_addr };
+}
+
+static inline struct extent_range
+extent_range_union(struct extent_range a, struct extent_range b) {
+  if (a.lo_addr == a.hi_addr) return b;
+  if (b.lo_addr == b.hi_addr) return a;
+  return (struct extent_range){
+    a.lo_addr < b.lo_addr ? a.lo_addr : b.lo_addr,
+    a.hi_addr > b.hi_addr ? a.hi_addr : b.hi_addr
+  };
+}
+
 static struct extents*
 extents_allocate(size_t capacity) {
   size_t byte_size =
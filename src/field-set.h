@@ -3,90 +3,140 @@
 
 #include <pthread.h>
 #include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #include "assert.h"
+#include "gc-align.h"
 #include "gc-edge.h"
 #include "gc-lock.h"
+#include "gc-platform.h"
 #include "tracer.h"
 
 #define GC_EDGE_BUFFER_CAPACITY 510
 
 struct gc_edge_buffer {
   struct gc_edge_buffer *next;
-  size_t size;
+  uint32_t index;
+  uint32_t size;
   struct gc_edge edges[GC_EDGE_BUFFER_CAPACITY];
 };
 
-// Lock-free.
-struct gc_edge_buffer_list {
-  struct gc_edge_buffer *head;
+// Edge buffers are carved out of chunks that are allocated on demand
+// and never freed; buffers are recycled across collections instead.
+// Each buffer has an index into the arena, which lets buffer lists use
+// ABA-safe tagged heads.
+#define GC_EDGE_BUFFER_CHUNK_SIZE_LOG2 8
+#define GC_EDGE_BUFFER_CHUNK_SIZE (1 << GC_EDGE_BUFFER_CHUNK_SIZE_LOG2)
+#define GC_EDGE_BUFFER_INITIAL_CHUNK_TABLE_SIZE 16
+// Buffer indices, plus one, have to fit in 32 bits.
+#define GC_EDGE_BUFFER_MAX_COUNT ((size_t)UINT32_MAX)
+
+// The chunk table doubles in size as needed.  Buffer lists are read
+// without the lock, so a table that has been replaced may still be in
+// use; it stays allocated, linked from its successor.
+struct gc_edge_buffer_chunk_table {
+  struct gc_edge_buffer_chunk_table *prev;
+  size_t size;
+  struct gc_edge_buffer *chunks[];
+};
+
+struct gc_edge_buffer_arena {
+  size_t count;
+  struct gc_edge_buffer_chunk_table *table;
 };
 
-// With a lock.
-struct gc_edge_buffer_stack {
-  struct gc_edge_buffer_list list;
+// Lock-free.  The head holds the index of the first buffer, plus one so
+// that zero is the empty list, in its low 32 bits, and a modification
+// count in its high 32 bits.
+struct gc_edge_buffer_list {
+  uint64_t head;
 };
 
 struct gc_field_set {
   struct gc_edge_buffer_list full;
-  struct gc_edge_buffer_stack partly_full;
+  struct gc_edge_buffer_list partly_full;
   struct gc_edge_buffer_list empty;
-  size_t count;
+  struct gc_edge_buffer_arena arena;
+  // Number of buffers taken into use since the set was last cleared.
+  size_t active_buffer_count;
   pthread_mutex_t lock;
 };
 
+// Each writer keeps a small cache of empty buffers, to avoid contention
+// on the shared lists.
+#define GC_FIELD_SET_WRITER_CACHE_SIZE 8
+
 struct gc_field_set_writer {
   struct gc_edge_buffer *buf;
+  struct gc_edge_buffer *cache;
+  size_t cache_size;
   struct gc_field_set *set;
 };
 
+static inline struct gc_edge_buffer*
+gc_edge_buffer_arena_ref(struct gc_edge_buffer_arena *arena, uint64_t head) {
+  uint32_t idx = head;
+  if (!idx) return NULL;
+  idx--;
+  struct gc_edge_buffer_chunk_table *table =
+    atomic_load_explicit(&arena->table, memory_order_acquire);
+  struct gc_edge_buffer *chunk =
+    atomic_load_explicit(&table->chunks[idx >> GC_EDGE_BUFFER_CHUNK_SIZE_LOG2],
+                         memory_order_relaxed);
+  return &chunk[idx & (GC_EDGE_BUFFER_CHUNK_SIZE - 1)];
+}
+
+static inline uint64_t
+gc_edge_buffer_list_next_head(uint64_t head, struct gc_edge_buffer *buf) {
+  uint64_t count = (head >> 32) + 1;
+  return (count << 32) | (buf ? buf->index + 1 : 0);
+}
+
 static void
-gc_edge_buffer_list_push(struct gc_edge_buffer_list *list,
+gc_edge_buffer_list_push(struct gc_edge_buffer_arena *arena,
+                         struct gc_edge_buffer_list *list,
                          struct gc_edge_buffer *buf) {
   GC_ASSERT(!buf->next);
-  struct gc_edge_buffer *next =
-    atomic_load_explicit(&list->head, memory_order_relaxed);
+  uint64_t head = atomic_load_explicit(&list->head, memory_order_relaxed);
   do {
-    buf->next = next;
-  } while (!atomic_compare_exchange_weak_explicit(&list->head, &next, buf,
-                                                  memory_order_acq_rel,
-                                                  memory_order_acquire));
+    atomic_store_explicit(&buf->next, gc_edge_buffer_arena_ref(arena, head),
+                          memory_order_relaxed);
+  } while (!atomic_compare_exchange_weak_explicit
+           (&list->head, &head, gc_edge_buffer_list_next_head(head, buf),
+            memory_order_acq_rel, memory_order_acquire));
 }
 
 static struct gc_edge_buffer*
-gc_edge_buffer_list_pop(struct gc_edge_buffer_list *list) {
-  struct gc_edge_buffer *head =
-    atomic_load_explicit(&list->head, memory_order_acquire);
+gc_edge_buffer_list_pop(struct gc_edge_buffer_arena *arena,
+                        struct gc_edge_buffer_list *list) {
+  uint64_t head = atomic_load_explicit(&list->head, memory_order_acquire);
+  struct gc_edge_buffer *buf;
   struct gc_edge_buffer *next;
   do {
-    if (!head) return NULL;
-    next = head->next;
-  } while (!atomic_compare_exchange_weak_explicit(&list->head, &head, next,
-                                                  memory_order_acq_rel,
-                                                  memory_order_acquire));
-  head->next = NULL;
-  return head;
-}
-
-static void
-gc_edge_buffer_stack_push(struct gc_edge_buffer_stack *stack,
-                          struct gc_edge_buffer *buf,
-                          const struct gc_lock *lock) {
-  GC_ASSERT(!buf->next);
-  buf->next = stack->list.head;
-  stack->list.head = buf;
+    buf = gc_edge_buffer_arena_ref(arena, head);
+    if (!buf) return NULL;
+    // If BUF was concurrently popped, its next link may be stale, but
+    // then the head's modification count will have changed too.
+    next = atomic_load_explicit(&buf->next, memory_order_relaxed);
+  } while (!atomic_compare_exchange_weak_explicit
+           (&list->head, &head, gc_edge_buffer_list_next_head(head, next),
+            memory_order_acq_rel, memory_order_acquire));
+  buf->next = NULL;
+  return buf;
 }
 
+// Detach all buffers from LIST, returning them linked by their next
+// pointers.
 static struct gc_edge_buffer*
-gc_edge_buffer_stack_pop(struct gc_edge_buffer_stack *stack,
-                         const struct gc_lock *lock) {
-  struct gc_edge_buffer *head = stack->list.head;
-  if (head) {
-    stack->list.head = head->next;
-    head->next = NULL;
-  }
-  return head;
+gc_edge_buffer_list_take(struct gc_edge_buffer_arena *arena,
+                         struct gc_edge_buffer_list *list) {
+  uint64_t head = atomic_load_explicit(&list->head, memory_order_acquire);
+  while (!atomic_compare_exchange_weak_explicit
+         (&list->head, &head, gc_edge_buffer_list_next_head(head, NULL),
+          memory_order_acq_rel, memory_order_acquire))
+    ;
+  return gc_edge_buffer_arena_ref(arena, head);
 }
 
 static void
@@ -95,61 +145,101 @@ gc_field_set_init(struct gc_field_set *set) {
   pthread_mutex_init(&set->lock, NULL);
 }
 
-static struct gc_edge_buffer*
-gc_field_set_acquire_buffer(struct gc_field_set *set) {
-  struct gc_edge_buffer *ret;
-
-  ret = gc_edge_buffer_list_pop(&set->empty);
-  if (ret) return ret;
+// Replace the chunk table with one twice as big.  Call with the field
+// set lock held.
+static void
+gc_edge_buffer_arena_grow_table(struct gc_edge_buffer_arena *arena) {
+  struct gc_edge_buffer_chunk_table *old = arena->table;
+  size_t size = old ? old->size * 2 : GC_EDGE_BUFFER_INITIAL_CHUNK_TABLE_SIZE;
+  struct gc_edge_buffer_chunk_table *table =
+    malloc(sizeof(*table) + sizeof(table->chunks[0]) * size);
+  if (!table) {
+    perror("Failed to grow remembered set");
+    GC_CRASH();
+  }
+  table->prev = old;
+  table->size = size;
+  size_t old_size = old ? old->size : 0;
+  for (size_t i = 0; i < old_size; i++)
+    table->chunks[i] = old->chunks[i];
+  for (size_t i = old_size; i < size; i++)
+    table->chunks[i] = NULL;
+  atomic_store_explicit(&arena->table, table, memory_order_release);
+}
 
+// Allocate COUNT fresh buffers from the arena, returning them linked by
+// their next pointers.
+static struct gc_edge_buffer*
+gc_field_set_allocate_buffers(struct gc_field_set *set, size_t count) {
+  struct gc_edge_buffer_arena *arena = &set->arena;
+  struct gc_edge_buffer *ret = NULL;
   struct gc_lock lock = gc_lock_acquire(&set->lock);
-  ret = gc_edge_buffer_stack_pop(&set->partly_full, &lock);
-  gc_lock_release(&lock);
-  if (ret) return ret;
-
-  // atomic inc count
-  ret = malloc(sizeof(*ret));
-  if (!ret) {
-    perror("Failed to allocate remembered set");
-    GC_CRASH();
+  for (size_t i = 0; i < count; i++) {
+    size_t idx = arena->count;
+    size_t chunk_idx = idx >> GC_EDGE_BUFFER_CHUNK_SIZE_LOG2;
+    if (idx == GC_EDGE_BUFFER_MAX_COUNT) {
+      fprintf(stderr, "Remembered set too large\n");
+      GC_CRASH();
+    }
+    if ((idx & (GC_EDGE_BUFFER_CHUNK_SIZE - 1)) == 0) {
+      if (!arena->table || chunk_idx == arena->table->size)
+        gc_edge_buffer_arena_grow_table(arena);
+      size_t bytes = align_up(sizeof(struct gc_edge_buffer)
+                              * GC_EDGE_BUFFER_CHUNK_SIZE,
+                              gc_platform_page_size());
+      struct gc_edge_buffer *chunk = gc_platform_acquire_memory(bytes, 0);
+      if (!chunk) {
+        perror("Failed to allocate remembered set");
+        GC_CRASH();
+      }
+      atomic_store_explicit(&arena->table->chunks[chunk_idx], chunk,
+                            memory_order_release);
+    }
+    struct gc_edge_buffer *buf =
+      &arena->table->chunks[chunk_idx][idx & (GC_EDGE_BUFFER_CHUNK_SIZE - 1)];
+    buf->index = idx;
+    buf->next = ret;
+    ret = buf;
+    arena->count++;
   }
-  memset(ret, 0, sizeof(*ret));
+  gc_lock_release(&lock);
   return ret;
 }
 
+static size_t
+gc_field_set_active_buffer_count(struct gc_field_set *set) {
+  return atomic_load_explicit(&set->active_buffer_count,
+                              memory_order_relaxed);
+}
+
 static void
 gc_field_set_release_buffer(struct gc_field_set *set,
                             struct gc_edge_buffer *buf) {
-  if (buf->size == GC_EDGE_BUFFER_CAPACITY) {
-    gc_edge_buffer_list_push(&set->full, buf);
-  } else {
-    struct gc_lock lock = gc_lock_acquire(&set->lock);
-    gc_edge_buffer_stack_push(&set->partly_full, buf, &lock);
-    gc_lock_release(&lock);
-  }
+  if (buf->size == GC_EDGE_BUFFER_CAPACITY)
+    gc_edge_buffer_list_push(&set->arena, &set->full, buf);
+  else
+    gc_edge_buffer_list_push(&set->arena, &set->partly_full, buf);
 }
 
 static void
 gc_field_set_add_roots(struct gc_field_set *set, struct gc_tracer *tracer) {
   struct gc_edge_buffer *buf;
-  struct gc_lock lock = gc_lock_acquire(&set->lock);
-  while ((buf = gc_edge_buffer_stack_pop(&set->partly_full, &lock)))
+  while ((buf = gc_edge_buffer_list_pop(&set->arena, &set->partly_full)))
     gc_tracer_add_root(tracer, gc_root_edge_buffer(buf));
-  while ((buf = gc_edge_buffer_list_pop(&set->full)))
+  while ((buf = gc_edge_buffer_list_pop(&set->arena, &set->full)))
     gc_tracer_add_root(tracer, gc_root_edge_buffer(buf));
-  gc_lock_release(&lock);
 }
 
 static void
 gc_field_set_clear(struct gc_field_set *set,
                    void (*forget_edge)(struct gc_edge, struct gc_heap*),
                    struct gc_heap *heap) {
-  struct gc_edge_buffer *partly_full = set->partly_full.list.head;
-  struct gc_edge_buffer *full = set->full.head;
   // Clear the full and partly full sets now so that if a collector
   // wanted to it could re-add an edge to the remembered set.
-  set->partly_full.list.head = NULL;
-  set->full.head = NULL;
+  struct gc_edge_buffer *partly_full =
+    gc_edge_buffer_list_take(&set->arena, &set->partly_full);
+  struct gc_edge_buffer *full =
+    gc_edge_buffer_list_take(&set->arena, &set->full);
   struct gc_edge_buffer *buf, *next;
   for (buf = partly_full; buf; buf = next) {
     next = buf->next;
@@ -158,7 +248,7 @@ gc_field_set_clear(struct gc_field_set *set,
       for (size_t i = 0; i < buf->size; i++)
         forget_edge(buf->edges[i], heap);
     buf->size = 0;
-    gc_edge_buffer_list_push(&set->empty, buf);
+    gc_edge_buffer_list_push(&set->arena, &set->empty, buf);
   }
   for (buf = full; buf; buf = next) {
     next = buf->next;
@@ -167,8 +257,46 @@ gc_field_set_clear(struct gc_field_set *set,
       for (size_t i = 0; i < buf->size; i++)
         forget_edge(buf->edges[i], heap);
     buf->size = 0;
-    gc_edge_buffer_list_push(&set->empty, buf);
+    gc_edge_buffer_list_push(&set->arena, &set->empty, buf);
+  }
+  atomic_store_explicit(&set->active_buffer_count, 0, memory_order_relaxed);
+}
+
+// Like gc_field_set_clear, but keep the edges for which RETAIN_EDGE
+// returns nonzero.  RETAIN_EDGE is responsible for forgetting the edges
+// that it drops.
+static void
+gc_field_set_retain(struct gc_field_set *set,
+                    int (*retain_edge)(struct gc_edge, struct gc_heap*),
+                    struct gc_heap *heap) {
+  struct gc_edge_buffer *partly_full =
+    gc_edge_buffer_list_take(&set->arena, &set->partly_full);
+  struct gc_edge_buffer *full =
+    gc_edge_buffer_list_take(&set->arena, &set->full);
+  struct gc_edge_buffer *lists[2] = { partly_full, full };
+  size_t active = 0;
+  for (size_t list = 0; list < 2; list++) {
+    struct gc_edge_buffer *buf, *next;
+    for (buf = lists[list]; buf; buf = next) {
+      next = buf->next;
+      buf->next = NULL;
+      size_t i = 0;
+      while (i < buf->size) {
+        if (retain_edge(buf->edges[i], heap))
+          i++;
+        else
+          buf->edges[i] = buf->edges[--buf->size];
+      }
+      if (buf->size) {
+        gc_field_set_release_buffer(set, buf);
+        active++;
+      } else {
+        gc_edge_buffer_list_push(&set->arena, &set->empty, buf);
+      }
+    }
   }
+  atomic_store_explicit(&set->active_buffer_count, active,
+                        memory_order_relaxed);
 }
 
 static inline void
@@ -205,11 +333,60 @@ gc_field_set_writer_release_buffer(struct gc_field_set_writer *writer) {
   }
 }
 
+// Release the writer's buffer and return its cached empty buffers to
+// the set.  Call when the writer will not be used again.
+static void
+gc_field_set_writer_finish(struct gc_field_set_writer *writer) {
+  gc_field_set_writer_release_buffer(writer);
+  struct gc_edge_buffer *buf, *next;
+  for (buf = writer->cache; buf; buf = next) {
+    next = buf->next;
+    buf->next = NULL;
+    gc_edge_buffer_list_push(&writer->set->arena, &writer->set->empty, buf);
+  }
+  writer->cache = NULL;
+  writer->cache_size = 0;
+}
+
 static void
 gc_field_set_writer_init(struct gc_field_set_writer *writer,
                          struct gc_field_set *set) {
   writer->set = set;
   writer->buf = NULL;
+  writer->cache = NULL;
+  writer->cache_size = 0;
+}
+
+static struct gc_edge_buffer*
+gc_field_set_writer_acquire_buffer(struct gc_field_set_writer *writer) {
+  struct gc_field_set *set = writer->set;
+  if (!writer->cache) {
+    // Refill the cache from the set's empty buffers.
+    struct gc_edge_buffer *buf;
+    while (writer->cache_size < GC_FIELD_SET_WRITER_CACHE_SIZE
+           && (buf = gc_edge_buffer_list_pop(&set->arena, &set->empty))) {
+      buf->next = writer->cache;
+      writer->cache = buf;
+      writer->cache_size++;
+    }
+  }
+  if (!writer->cache) {
+    // Prefer continuing a partly full buffer to growing the arena.
+    struct gc_edge_buffer *buf =
+      gc_edge_buffer_list_pop(&set->arena, &set->partly_full);
+    if (buf)
+      return buf;
+    writer->cache =
+      gc_field_set_allocate_buffers(set, GC_FIELD_SET_WRITER_CACHE_SIZE);
+    writer->cache_size = GC_FIELD_SET_WRITER_CACHE_SIZE;
+  }
+  struct gc_edge_buffer *ret = writer->cache;
+  writer->cache = ret->next;
+  writer->cache_size--;
+  ret->next = NULL;
+  atomic_fetch_add_explicit(&set->active_buffer_count, 1,
+                            memory_order_relaxed);
+  return ret;
 }
 
 static void
@@ -217,11 +394,11 @@ gc_field_set_writer_add_edge(struct gc_field_set_writer *writer,
                              struct gc_edge edge) {
   struct gc_edge_buffer *buf = writer->buf;
   if (GC_UNLIKELY(!buf))
-    writer->buf = buf = gc_field_set_acquire_buffer(writer->set);
+    writer->buf = buf = gc_field_set_writer_acquire_buffer(writer);
   GC_ASSERT(buf->size < GC_EDGE_BUFFER_CAPACITY);
   buf->edges[buf->size++] = edge;
   if (GC_UNLIKELY(buf->size == GC_EDGE_BUFFER_CAPACITY)) {
-    gc_edge_buffer_list_push(&writer->set->full, buf);
+    gc_edge_buffer_list_push(&writer->set->arena, &writer->set->full, buf);
     writer->buf = NULL;
   }
 }
@@ -0,0 +1,46 @@
+#ifndef GC_EVENT_LISTENER_INTERNAL_H
+#define GC_EVENT_LISTENER_INTERNAL_H
+
+#ifndef GC_IMPL
+#error internal header file, not part of API
+#endif
+
+#include "gc-event-listener.h"
+#include "gc-probe.h"
+
+// By default, collectors call event handlers indirectly through the
+// struct gc_event_listener passed to gc_init.  If the collector is
+// compiled with GC_STATIC_EVENT_LISTENER defined to some PREFIX,
+// events are instead dispatched directly to PREFIX_init,
+// PREFIX_requesting_stop, and so on, which the embedder makes visible
+// to the collector's compilation unit, usually from its embedder
+// header.  The struct passed to gc_init is then ignored, though its
+// data pointer is still passed to the handlers.  If the handlers are
+// inline, the compiler can inline them too, and a null listener
+// compiles to nothing.
+
+#ifdef GC_STATIC_EVENT_LISTENER
+#define GC_EVENT_LISTENER_PASTE_(prefix, event) prefix##_##event
+#define GC_EVENT_LISTENER_PASTE(prefix, event) \
+  GC_EVENT_LISTENER_PASTE_(prefix, event)
+#define GC_EVENT_HANDLER(listener, event) \
+  GC_EVENT_LISTENER_PASTE(GC_STATIC_EVENT_LISTENER, event)
+#else
+#define GC_EVENT_HANDLER(listener, event) (listener).event
+#endif
+
+// Each event also fires a static probe of the same name.  Heap event
+// probes take the event's arguments; mutator event probes take the
+// mutator.
+#define GC_HEAP_EVENT(listener, data, event, ...)                       \
+  ({                                                                    \
+    GC_PROBE(event, ##__VA_ARGS__);                                     \
+    GC_EVENT_HANDLER(listener, event)(data, ##__VA_ARGS__);             \
+  })
+#define GC_MUTATOR_EVENT(listener, mut, data, event)                    \
+  ({                                                                    \
+    GC_PROBE(event, mut);                                               \
+    GC_EVENT_HANDLER(listener, event)(data);                            \
+  })
+
+#endif // GC_EVENT_LISTENER_INTERNAL_H
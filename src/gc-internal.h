@@ -6,6 +6,7 @@
 #endif
 
 #include "gc-ephemeron-internal.h"
+#include "gc-event-listener-internal.h"
 #include "gc-finalizer-internal.h"
 #include "gc-options-internal.h"
 
@@ -14,6 +14,11 @@ struct gc_common_options {
   double heap_size_multiplier;
   double heap_expansiveness;
   int parallelism;
+  double trace_worker_idle_timeout;
+  double remembered_set_limit;
+  int retention_report_interval;
+  int promotion_age;
+  int trace_worklist_max_log_size;
 };
 
 GC_INTERNAL void gc_init_common_options(struct gc_common_options *options);
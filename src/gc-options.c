@@ -14,7 +14,12 @@
     int, heap_size_policy, GC_HEAP_SIZE_FIXED, GC_HEAP_SIZE_FIXED,      \
     GC_HEAP_SIZE_ADAPTIVE)                                              \
   M(PARALLELISM, parallelism, "parallelism",                            \
-    int, int, default_parallelism(), 1, 64)
+    int, int, default_parallelism(), 1, 64)                             \
+  M(RETENTION_REPORT_INTERVAL, retention_report_interval,               \
+    "retention-report-interval", int, int, 0, 0, INT_MAX)               \
+  M(PROMOTION_AGE, promotion_age, "promotion-age", int, int, 1, 1, 2)   \
+  M(TRACE_WORKLIST_MAX_LOG_SIZE, trace_worklist_max_log_size,           \
+    "trace-worklist-max-log-size", int, int, 20, 10, 28)
 
 #define FOR_EACH_SIZE_GC_OPTION(M)                                      \
   M(HEAP_SIZE, heap_size, "heap-size",                                  \
@@ -26,7 +31,11 @@
   M(HEAP_SIZE_MULTIPLIER, heap_size_multiplier, "heap-size-multiplier", \
     double, double, 1.75, 1.0, 1e6)                                     \
   M(HEAP_EXPANSIVENESS, heap_expansiveness, "heap-expansiveness",       \
-    double, double, 1.0, 0.0, 50.0)
+    double, double, 1.0, 0.0, 50.0)                                     \
+  M(TRACE_WORKER_IDLE_TIMEOUT, trace_worker_idle_timeout,               \
+    "trace-worker-idle-timeout", double, double, 10.0, 0.0, 1e6)        \
+  M(REMEMBERED_SET_LIMIT, remembered_set_limit, "remembered-set-limit", \
+    double, double, 0.25, 0.0, 1e6)
 
 typedef int gc_option_int;
 typedef size_t gc_option_size;
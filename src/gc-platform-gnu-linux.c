@@ -4,6 +4,7 @@
 #include <link.h>
 #include <pthread.h>
 #include <sched.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <sys/mman.h>
 #include <time.h>
@@ -107,6 +108,28 @@ void gc_platform_visit_global_conservative_roots(void (*f)(uintptr_t start,
   dl_iterate_phdr(visit_roots, &visit_data);
 }
 
+static int read_loader_generation(struct dl_phdr_info *info, size_t size,
+                                  void *data) {
+  uint64_t *generation = data;
+  // The load and unload counters are the same for every object; we only
+  // need to look at the first one.
+  if (size >= offsetof(struct dl_phdr_info, dlpi_subs)
+      + sizeof(info->dlpi_subs))
+    *generation = info->dlpi_adds + info->dlpi_subs;
+  return 1;
+}
+
+uint64_t gc_platform_global_conservative_roots_generation(void) {
+  static uint64_t fallback_generation;
+  uint64_t generation = 0;
+  dl_iterate_phdr(read_loader_generation, &generation);
+  // If the C library doesn't count loads and unloads, report a change
+  // every time.
+  if (!generation)
+    generation = ++fallback_generation;
+  return generation;
+}
+
 int gc_platform_processor_count(void) {
   cpu_set_t set;
   if (sched_getaffinity(0, sizeof (set), &set) != 0)
@@ -163,7 +186,8 @@ gc_platform_acquire_memory_from_reservation(struct gc_reservation reservation,
   GC_ASSERT(offset <= reservation.size - size);
 
   void *mem = mmap((void*)(reservation.base + offset), size,
-                   PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+                   PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED,
+                   -1, 0);
   if (mem == MAP_FAILED) {
     perror("mmap failed");
     return NULL;
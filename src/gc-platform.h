@@ -20,6 +20,10 @@ void gc_platform_visit_global_conservative_roots(void (*f)(uintptr_t start,
                                                            void *data),
                                                  struct gc_heap *heap,
                                                  void *data);
+// Returns a nonzero value that changes whenever the set of ranges
+// visited by gc_platform_visit_global_conservative_roots may have
+// changed, for example because a shared object was loaded or unloaded.
+GC_INTERNAL uint64_t gc_platform_global_conservative_roots_generation(void);
 GC_INTERNAL int gc_platform_processor_count(void);
 GC_INTERNAL uint64_t gc_platform_monotonic_nanoseconds(void);
 
@@ -0,0 +1,81 @@
+#ifndef GC_PROBE_H
+#define GC_PROBE_H
+
+#include <stdint.h>
+
+// Static probe points, in the format of systemtap's <sys/sdt.h>, so
+// that perf, bpftrace, gdb and friends can find them in the binary and
+// attach to them at run-time.  Each probe is a nop in the instruction
+// stream, plus an entry in the .note.stapsdt ELF section giving the
+// address of the nop and where to find the probe's arguments.  Until a
+// tool attaches, a probe costs only the nop and the work of computing
+// its arguments, which is why probes are placed on slow paths only.
+//
+// All probes are in the "whippet" provider.  GC_PROBE(name, ...) takes
+// up to three integer or pointer arguments, which are recorded as
+// 64-bit unsigned values.  Probes are emitted by default on 64-bit ELF
+// targets; compile with -DGC_PROBES=0 to leave them out.
+
+#ifndef GC_PROBES
+#if defined(__ELF__) && (defined(__x86_64__) || defined(__aarch64__))
+#define GC_PROBES 1
+#else
+#define GC_PROBES 0
+#endif
+#endif
+
+#if GC_PROBES
+
+#define GC_PROBE_ASM(name, args)                                        \
+  "990: nop\n"                                                          \
+  ".pushsection .note.stapsdt,\"?\",\"note\"\n"                         \
+  ".balign 4\n"                                                         \
+  ".4byte 992f-991f, 994f-993f, 3\n"                                    \
+  "991: .asciz \"stapsdt\"\n"                                           \
+  "992: .balign 4\n"                                                    \
+  "993: .8byte 990b\n"                                                  \
+  ".8byte _.stapsdt.base\n"                                             \
+  ".8byte 0\n"                                                          \
+  ".asciz \"whippet\"\n"                                                \
+  ".asciz \"" #name "\"\n"                                              \
+  ".asciz \"" args "\"\n"                                               \
+  "994: .balign 4\n"                                                    \
+  ".popsection\n"                                                       \
+  ".ifndef _.stapsdt.base\n"                                            \
+  ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+  ".weak _.stapsdt.base\n"                                              \
+  ".hidden _.stapsdt.base\n"                                            \
+  "_.stapsdt.base: .space 1\n"                                          \
+  ".size _.stapsdt.base, 1\n"                                           \
+  ".popsection\n"                                                       \
+  ".endif\n"
+
+#define GC_PROBE_ARG(x) "nor" ((uint64_t)(uintptr_t)(x))
+
+#define GC_PROBE0(name)                                                 \
+  __asm__ __volatile__ (GC_PROBE_ASM(name, ""))
+#define GC_PROBE1(name, x)                                              \
+  __asm__ __volatile__ (GC_PROBE_ASM(name, "8@%[a]")                    \
+                        :: [a] GC_PROBE_ARG(x))
+#define GC_PROBE2(name, x, y)                                           \
+  __asm__ __volatile__ (GC_PROBE_ASM(name, "8@%[a] 8@%[b]")             \
+                        :: [a] GC_PROBE_ARG(x), [b] GC_PROBE_ARG(y))
+#define GC_PROBE3(name, x, y, z)                                        \
+  __asm__ __volatile__ (GC_PROBE_ASM(name, "8@%[a] 8@%[b] 8@%[c]")      \
+                        :: [a] GC_PROBE_ARG(x), [b] GC_PROBE_ARG(y),    \
+                           [c] GC_PROBE_ARG(z))
+
+#define GC_PROBE_PASTE_(a, b) a##b
+#define GC_PROBE_PASTE(a, b) GC_PROBE_PASTE_(a, b)
+#define GC_PROBE_ARITY(_0, _1, _2, _3, n, ...) n
+#define GC_PROBE(...)                                                   \
+  GC_PROBE_PASTE(GC_PROBE, GC_PROBE_ARITY(__VA_ARGS__, 3, 2, 1, 0, _))  \
+    (__VA_ARGS__)
+
+#else // GC_PROBES
+
+#define GC_PROBE(...) do {} while (0)
+
+#endif // GC_PROBES
+
+#endif // GC_PROBE_H
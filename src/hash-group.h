@@ -0,0 +1,123 @@
+#ifndef HASH_GROUP_H
+#define HASH_GROUP_H
+
+// Helpers for open-addressing hash tables in the style of Abseil's
+// "Swiss tables".  Each slot has a control byte, which is either empty,
+// deleted, or holds the low 7 bits of the hash of the slot's key.
+// Lookup probes a whole group of 16 control bytes at a time, using
+// SSE2 if available and SWAR otherwise, and only compares keys for
+// slots whose control bytes match.  Groups are aligned, and the
+// remaining bits of the hash select the first group to probe.
+
+#include <malloc.h>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "gc-assert.h"
+#include "swar.h"
+
+#define HASH_GROUP_SIZE 16
+
+#define HASH_CTRL_EMPTY 0x80
+#define HASH_CTRL_DELETED 0xfe
+
+// One bit per slot in the group.
+typedef unsigned hash_group_mask;
+
+static inline uint8_t
+hash_ctrl_tag(uintptr_t hash) {
+  return hash & 0x7f;
+}
+static inline size_t
+hash_first_group(uintptr_t hash) {
+  return hash >> 7;
+}
+
+static inline size_t
+hash_group_mask_first(hash_group_mask mask) {
+  GC_ASSERT(mask);
+  return __builtin_ctz(mask);
+}
+static inline hash_group_mask
+hash_group_mask_rest(hash_group_mask mask) {
+  return mask & (mask - 1);
+}
+
+#ifdef __SSE2__
+static inline hash_group_mask
+hash_group_match(const uint8_t *ctrl, uint8_t byte) {
+  __m128i group = _mm_load_si128((const __m128i*)ctrl);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(byte)));
+}
+static inline hash_group_mask
+hash_group_match_empty_or_deleted(const uint8_t *ctrl) {
+  __m128i group = _mm_load_si128((const __m128i*)ctrl);
+  return _mm_movemask_epi8(group);
+}
+#else
+// May report false positives for tags; see match_bytes_against_byte.
+// This is fine for tags, as keys are compared anyway, and can't happen
+// for HASH_CTRL_EMPTY, as 0x81 is not a valid control byte.
+static inline hash_group_mask
+hash_group_match(const uint8_t *ctrl, uint8_t byte) {
+  hash_group_mask ret = 0;
+  for (size_t i = 0; i < HASH_GROUP_SIZE; i += 8) {
+    uint64_t bytes = load_eight_aligned_bytes((uint8_t*)ctrl + i);
+    ret |= pack_high_bits(match_bytes_against_byte(bytes, byte)) << i;
+  }
+  return ret;
+}
+static inline hash_group_mask
+hash_group_match_empty_or_deleted(const uint8_t *ctrl) {
+  hash_group_mask ret = 0;
+  for (size_t i = 0; i < HASH_GROUP_SIZE; i += 8)
+    ret |= pack_high_bits(load_eight_aligned_bytes((uint8_t*)ctrl + i)) << i;
+  return ret;
+}
+#endif
+
+static inline hash_group_mask
+hash_group_match_empty(const uint8_t *ctrl) {
+  return hash_group_match(ctrl, HASH_CTRL_EMPTY);
+}
+static inline hash_group_mask
+hash_group_match_full(const uint8_t *ctrl) {
+  return ~hash_group_match_empty_or_deleted(ctrl) & 0xffff;
+}
+
+// Probe groups in triangular order, which visits every group if the
+// number of groups is a power of two.
+struct hash_probe {
+  size_t group;
+  size_t stride;
+  size_t mask;
+};
+
+static inline struct hash_probe
+hash_probe_start(uintptr_t hash, size_t ngroups) {
+  GC_ASSERT((ngroups & (ngroups - 1)) == 0);
+  size_t mask = ngroups - 1;
+  return (struct hash_probe) { hash_first_group(hash) & mask, 0, mask };
+}
+static inline void
+hash_probe_next(struct hash_probe *probe) {
+  probe->stride++;
+  probe->group = (probe->group + probe->stride) & probe->mask;
+}
+static inline size_t
+hash_probe_offset(struct hash_probe *probe) {
+  return probe->group * HASH_GROUP_SIZE;
+}
+
+static uint8_t*
+hash_ctrl_allocate(size_t size) {
+  GC_ASSERT(size % HASH_GROUP_SIZE == 0);
+  uint8_t *ret = memalign(HASH_GROUP_SIZE, size);
+  if (!ret) GC_CRASH();
+  return ret;
+}
+
+#endif // HASH_GROUP_H
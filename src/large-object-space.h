@@ -16,25 +16,23 @@
 #include "background-thread.h"
 #include "freelist.h"
 
-// A mark-sweep space with generational support.
+// A mark-sweep space with generational support.  Sweeping is lazy: at
+// the end of a collection, the objects to sweep are set aside in O(1),
+// and are swept by allocation, in proportion to the pages it allocates,
+// and by the background thread.  Objects may still be unswept when the
+// next collection starts; their mark values are epochs that don't
+// repeat, so they keep their verdict from the collection that left them.
 
 struct gc_heap;
 
-enum large_object_state {
-  LARGE_OBJECT_NURSERY = 0,
-  LARGE_OBJECT_MARKED_BIT = 1,
-  LARGE_OBJECT_MARK_TOGGLE_BIT = 2,
-  LARGE_OBJECT_MARK_0 = LARGE_OBJECT_MARKED_BIT,
-  LARGE_OBJECT_MARK_1 = LARGE_OBJECT_MARKED_BIT | LARGE_OBJECT_MARK_TOGGLE_BIT
-};
-
 struct large_object {
   uintptr_t addr;
   size_t size;
 };
 struct large_object_node;
 struct large_object_live_data {
-  uint8_t mark;
+  uint64_t mark;
+  struct large_object_node *next;
 };
 struct large_object_dead_data {
   uint8_t age;
@@ -68,8 +66,55 @@ large_object_span_start(struct large_object obj) {
 DEFINE_FREELIST(large_object_freelist, sizeof(uintptr_t) * 8 - 1, 2,
                 struct large_object_node*);
 
+// A list of live objects, linked through their live data.
+struct large_object_list {
+  struct large_object_node *head;
+  struct large_object_node *tail;
+};
+
+static inline int
+large_object_list_is_empty(struct large_object_list *list) {
+  return !list->head;
+}
+
+static void
+large_object_list_push(struct large_object_list *list,
+                       struct large_object_node *node) {
+  GC_ASSERT(node->value.is_live);
+  node->value.live.next = list->head;
+  if (!list->head)
+    list->tail = node;
+  list->head = node;
+}
+
+static struct large_object_node*
+large_object_list_pop(struct large_object_list *list) {
+  struct large_object_node *node = list->head;
+  if (node) {
+    list->head = node->value.live.next;
+    node->value.live.next = NULL;
+  }
+  return node;
+}
+
+static void
+large_object_list_append(struct large_object_list *list,
+                         struct large_object_list *other) {
+  if (large_object_list_is_empty(other))
+    return;
+  if (large_object_list_is_empty(list))
+    *list = *other;
+  else {
+    list->tail->value.live.next = other->head;
+    list->tail = other->tail;
+  }
+  *other = (struct large_object_list){ NULL, NULL };
+}
+
+#define LARGE_OBJECT_SWEEP_BATCH_SIZE 256
+
 struct large_object_space {
-  // Lock for object_map, quarantine, nursery, and marked.
+  // Lock for object_map, quarantine, the live object lists, and marked.
   pthread_mutex_t lock;
   // Lock for object_tree.
   pthread_mutex_t object_tree_lock;
@@ -80,10 +125,20 @@ struct large_object_space {
   // object_tree_lock.  remembered_edges_lock is a leaf; take no locks
   // when holding it.
 
-  // The value for a large_object_node's "mark" field indicating a
-  // marked object; always nonzero, and alternating between two values
-  // at every major GC.
-  uint8_t marked;
+  // The value that the current or last collection stores in the "mark"
+  // field of the objects that it marks.  It is even, and increases by
+  // two at every collection.  An object allocated since the last
+  // collection has the odd mark value one past it.  An object is old
+  // if its mark is even and at least survivor_mark: in a major
+  // collection, survivor_mark is the new marked value, whereas a minor
+  // collection keeps the survivor_mark of the collection before, so old
+  // objects stay marked.  The mark values are 64 bits wide, so they
+  // never wrap around.
+  uint64_t marked;
+  uint64_t survivor_mark;
+  // The survivor_mark of the collection before the current one, for
+  // telling apart the objects that it left unswept.
+  uint64_t unswept_survivor_mark;
 
   // Splay tree of objects, keyed by <addr, size> tuple.  Useful when
   // looking up object-for-address.
@@ -94,9 +149,19 @@ struct large_object_space {
   // check something about it (for example its size).
   struct address_map object_map;
 
-  // In generational configurations, we collect all allocations in the
-  // last cycle into the nursery.
-  struct address_map nursery;
+  // Each live object is on one of these lists.  Objects allocated since
+  // the last collection are in the nursery; those that have survived a
+  // collection are survivors.  After a collection, the objects that it
+  // collected are on the to_sweep list until they are swept.  In
+  // generational configurations, a minor collection only needs to sweep
+  // the nursery.
+  struct large_object_list nursery;
+  struct large_object_list survivors;
+  struct large_object_list to_sweep;
+  // When the nofl space keeps young survivors young for another
+  // collection, nursery objects that survive a minor collection are set
+  // aside here, as the next minor collection has to trace them again.
+  struct large_object_list promoted;
 
   // Size-segregated freelist of dead objects.  Allocations are first
   // served from the quarantine freelist before falling back to the OS
@@ -158,10 +223,14 @@ static void
 large_object_space_start_gc(struct large_object_space *space, int is_minor_gc) {
   // Take the space lock to prevent
   // large_object_space_process_quarantine from concurrently mutating
-  // the object map.
+  // the object map.  The lock also keeps the sweepers off the to_sweep
+  // list until the collection finishes.
   pthread_mutex_lock(&space->lock);
+  space->unswept_survivor_mark = space->survivor_mark;
+  space->marked += 2;
   if (!is_minor_gc) {
-    space->marked ^= LARGE_OBJECT_MARK_TOGGLE_BIT;
+    large_object_list_append(&space->survivors, &space->promoted);
+    space->survivor_mark = space->marked;
     space->live_pages_at_last_collection = 0;
   }
 }
@@ -176,18 +245,41 @@ large_object_space_object_size(struct large_object_space *space,
   return node->key.size;
 }
 
-static uint8_t*
+static uint64_t*
 large_object_node_mark_loc(struct large_object_node *node) {
   GC_ASSERT(node->value.is_live);
   return &node->value.live.mark;
 }
 
-static uint8_t
+static uint64_t
 large_object_node_get_mark(struct large_object_node *node) {
   return atomic_load_explicit(large_object_node_mark_loc(node),
                               memory_order_acquire);
 }
 
+static inline int
+large_object_mark_is_old(uint64_t mark, uint64_t survivor_mark) {
+  return !(mark & 1) && mark >= survivor_mark;
+}
+
+static int
+large_object_node_is_marked(struct large_object_space *space,
+                            struct large_object_node *node) {
+  return large_object_mark_is_old(large_object_node_get_mark(node),
+                                  space->survivor_mark);
+}
+
+// During a collection, whether NODE is an object that the last
+// collection found dead but left unswept.
+static int
+large_object_node_is_unswept_dead(struct large_object_space *space,
+                                  struct large_object_node *node) {
+  uint64_t mark = large_object_node_get_mark(node);
+  if (mark == space->marked - 1)
+    return 0;
+  return !large_object_mark_is_old(mark, space->unswept_survivor_mark);
+}
+
 static struct large_object_node*
 large_object_space_lookup(struct large_object_space *space, struct gc_ref ref) {
   return (struct large_object_node*) address_map_lookup(&space->object_map,
@@ -202,10 +294,10 @@ large_object_space_mark(struct large_object_space *space, struct gc_ref ref) {
     return 0;
   GC_ASSERT(node->value.is_live);
 
-  uint8_t *loc = large_object_node_mark_loc(node);
-  uint8_t mark = atomic_load_explicit(loc, memory_order_relaxed);
+  uint64_t *loc = large_object_node_mark_loc(node);
+  uint64_t mark = atomic_load_explicit(loc, memory_order_relaxed);
   do {
-    if (mark == space->marked)
+    if (large_object_mark_is_old(mark, space->survivor_mark))
       return 0;
   } while (!atomic_compare_exchange_weak_explicit(loc, &mark, space->marked,
                                                   memory_order_acq_rel,
@@ -225,8 +317,7 @@ large_object_space_is_marked(struct large_object_space *space,
     return 0;
   GC_ASSERT(node->value.is_live);
 
-  return atomic_load_explicit(large_object_node_mark_loc(node),
-                              memory_order_acquire) == space->marked;
+  return large_object_node_is_marked(space, node);
 }
 
 static int
@@ -268,6 +359,14 @@ large_object_space_forget_edge(struct large_object_space *space,
   pthread_mutex_unlock(&space->remembered_edges_lock);
 }
 
+static size_t
+large_object_space_remembered_edge_count(struct large_object_space *space) {
+  pthread_mutex_lock(&space->remembered_edges_lock);
+  size_t count = address_set_size(&space->remembered_edges);
+  pthread_mutex_unlock(&space->remembered_edges_lock);
+  return count;
+}
+
 static void
 large_object_space_clear_remembered_edges(struct large_object_space *space) {
   address_set_clear(&space->remembered_edges);
@@ -302,18 +401,52 @@ large_object_space_remove_from_freelist(struct large_object_space *space,
   dead->next = NULL;
 }
 
+// Sweep one object from the to_sweep list, with the space lock held.
+// Returns the object if it was dead and is now on the freelist.
+static struct large_object_node*
+large_object_space_sweep_one(struct large_object_space *space) {
+  struct large_object_node *node = large_object_list_pop(&space->to_sweep);
+  if (!node)
+    return NULL;
+  GC_ASSERT(node->value.is_live);
+  if (large_object_node_is_marked(space, node)) {
+    large_object_list_push(&space->survivors, node);
+    return NULL;
+  }
+  large_object_space_add_to_freelist(space, node);
+  return node;
+}
+
+static void
+large_object_space_finish_sweeping(struct large_object_space *space) {
+  while (!large_object_list_is_empty(&space->to_sweep))
+    large_object_space_sweep_one(space);
+}
+
+// Sweep objects totalling at least NPAGES pages, if there are that many
+// left to sweep, so that sweeping keeps pace with allocation.  Called
+// with the space lock held.
 static void
-large_object_space_sweep_one(uintptr_t addr, uintptr_t node_bits,
-                             void *data) {
+large_object_space_sweep_pages(struct large_object_space *space,
+                               size_t npages) {
+  size_t swept = 0;
+  while (swept < npages && !large_object_list_is_empty(&space->to_sweep)) {
+    swept += space->to_sweep.head->key.size >> space->page_size_log2;
+    large_object_space_sweep_one(space);
+  }
+}
+
+static void
+large_object_space_sweep_in_background(void *data) {
   struct large_object_space *space = data;
-  struct large_object_node *node = (struct large_object_node*) node_bits;
-  if (!node->value.is_live)
-    return;
-  GC_ASSERT(node->value.is_live);
-  uint8_t mark = atomic_load_explicit(large_object_node_mark_loc(node),
-                                      memory_order_acquire);
-  if (mark != space->marked)
-    large_object_space_add_to_freelist(space, node);
+  int done;
+  do {
+    pthread_mutex_lock(&space->lock);
+    for (size_t i = 0; i < LARGE_OBJECT_SWEEP_BATCH_SIZE; i++)
+      large_object_space_sweep_one(space);
+    done = large_object_list_is_empty(&space->to_sweep);
+    pthread_mutex_unlock(&space->lock);
+  } while (!done);
 }
 
 static void
@@ -340,23 +473,51 @@ large_object_space_process_quarantine(void *data) {
   pthread_mutex_unlock(&space->lock);
 }
 
+// Move the nursery objects marked by the current minor collection to
+// the promoted list.  Called with the space lock held.
+static void
+large_object_space_set_aside_promoted(struct large_object_space *space) {
+  struct large_object_list nursery = space->nursery;
+  space->nursery = (struct large_object_list){ NULL, NULL };
+  struct large_object_node *node;
+  while ((node = large_object_list_pop(&nursery))) {
+    if (large_object_node_get_mark(node) == space->marked)
+      large_object_list_push(&space->promoted, node);
+    else
+      large_object_list_push(&space->nursery, node);
+  }
+}
+
+// Call VISIT on the extent of each object set aside by the last minor
+// collection, then make them ordinary survivors.  Called with the space
+// lock held.
+static void
+large_object_space_visit_promoted(struct large_object_space *space,
+                                  void (*visit)(uintptr_t, uintptr_t, void*),
+                                  void *visit_data) {
+  for (struct large_object_node *node = space->promoted.head;
+       node;
+       node = node->value.live.next)
+    visit(node->key.addr, node->key.addr + node->key.size, visit_data);
+  large_object_list_append(&space->survivors, &space->promoted);
+}
+
 static void
 large_object_space_finish_gc(struct large_object_space *space,
                              int is_minor_gc) {
-  if (GC_GENERATIONAL) {
-    address_map_for_each(is_minor_gc ? &space->nursery : &space->object_map,
-                         large_object_space_sweep_one,
-                         space);
-    address_map_clear(&space->nursery);
-  } else {
-    address_map_for_each(&space->object_map,
-                         large_object_space_sweep_one,
-                         space);
-  }
+  // Objects that the last collection left unswept stay on the to_sweep
+  // list: their mark values still tell whether they are live.
+  if (!(GC_GENERATIONAL && is_minor_gc))
+    large_object_list_append(&space->to_sweep, &space->survivors);
+  large_object_list_append(&space->to_sweep, &space->nursery);
   size_t free_pages =
     space->total_pages - space->live_pages_at_last_collection;
   space->pages_freed_by_last_collection = free_pages - space->free_pages;
   space->free_pages = free_pages;
+  // Without a background thread to sweep, sweep now, so that dead
+  // objects start their time in quarantine.
+  if (space->synchronous_release)
+    large_object_space_finish_sweeping(space);
   pthread_mutex_unlock(&space->lock);
   if (space->synchronous_release)
     large_object_space_process_quarantine(space);
@@ -395,56 +556,69 @@ large_object_space_mark_conservative_ref(struct large_object_space *space,
   }
 
   if (node && node->value.is_live &&
+      !large_object_node_is_unswept_dead(space, node) &&
       large_object_space_mark(space, gc_ref(node->key.addr)))
     return gc_ref(node->key.addr);
 
   return gc_ref_null();
 }
 
-static void*
-large_object_space_alloc(struct large_object_space *space, size_t npages) {
-  void *ret = NULL;
-  pthread_mutex_lock(&space->lock);
-  
-  size_t size = npages << space->page_size_log2;
+static struct large_object_node*
+large_object_space_find_hole(struct large_object_space *space, size_t size) {
   for (size_t idx = large_object_freelist_size_class(size);
        idx < large_object_freelist_num_size_classes();
        idx++) {
     struct large_object_node *node = space->quarantine.buckets[idx];
     while (node && node->key.size < size)
       node = node->value.dead.next;
-    if (node) {
-      // We found a suitable hole in quarantine.  Unlink it from the
-      // freelist.
-      large_object_space_remove_from_freelist(space, node);
-
-      // Mark the hole as live.
-      node->value.is_live = 1;
-      memset(&node->value.live, 0, sizeof(node->value.live));
-
-      // If the hole is actually too big, trim its tail.
-      if (node->key.size > size) {
-        struct large_object tail = {node->key.addr + size, node->key.size - size};
-        struct large_object_data tail_value = {0,};
-        node->key.size = size;
-        pthread_mutex_lock(&space->object_tree_lock);
-        struct large_object_node *tail_node =
-          large_object_tree_insert(&space->object_tree, tail, tail_value);
-        pthread_mutex_unlock(&space->object_tree_lock);
-        uintptr_t tail_node_bits = (uintptr_t)tail_node;
-        address_map_add(&space->object_map, tail_node->key.addr,
-                        tail_node_bits);
-        large_object_space_add_to_freelist(space, tail_node);
-      }
+    if (node)
+      return node;
+  }
+  return NULL;
+}
 
-      // Add the object to the nursery.
-      if (GC_GENERATIONAL)
-        address_map_add(&space->nursery, node->key.addr, (uintptr_t)node);
-    
-      space->free_pages -= npages;
-      ret = (void*)node->key.addr;
-      break;
+static void*
+large_object_space_alloc(struct large_object_space *space, size_t npages) {
+  void *ret = NULL;
+  pthread_mutex_lock(&space->lock);
+  
+  size_t size = npages << space->page_size_log2;
+  large_object_space_sweep_pages(space, npages);
+  struct large_object_node *node = large_object_space_find_hole(space, size);
+  // If there is no suitable hole yet, sweep until we find one.
+  while (!node && !large_object_list_is_empty(&space->to_sweep)) {
+    struct large_object_node *dead = large_object_space_sweep_one(space);
+    if (dead && dead->key.size >= size)
+      node = dead;
+  }
+  if (node) {
+    // We found a suitable hole in quarantine.  Unlink it from the
+    // freelist.
+    large_object_space_remove_from_freelist(space, node);
+
+    // Mark the hole as live.
+    node->value.is_live = 1;
+    memset(&node->value.live, 0, sizeof(node->value.live));
+    node->value.live.mark = space->marked + 1;
+
+    // If the hole is actually too big, trim its tail.
+    if (node->key.size > size) {
+      struct large_object tail = {node->key.addr + size, node->key.size - size};
+      struct large_object_data tail_value = {0,};
+      node->key.size = size;
+      pthread_mutex_lock(&space->object_tree_lock);
+      struct large_object_node *tail_node =
+        large_object_tree_insert(&space->object_tree, tail, tail_value);
+      pthread_mutex_unlock(&space->object_tree_lock);
+      uintptr_t tail_node_bits = (uintptr_t)tail_node;
+      address_map_add(&space->object_map, tail_node->key.addr,
+                      tail_node_bits);
+      large_object_space_add_to_freelist(space, tail_node);
     }
+
+    large_object_list_push(&space->nursery, node);
+    space->free_pages -= npages;
+    ret = (void*)node->key.addr;
   }
   pthread_mutex_unlock(&space->lock);
   return ret;
@@ -462,14 +636,15 @@ large_object_space_obtain_and_alloc(struct large_object_space *space,
   struct large_object k = { addr, bytes };
   struct large_object_data v = {0,};
   v.is_live = 1;
-  v.live.mark = 0;
 
   pthread_mutex_lock(&space->lock);
+  v.live.mark = space->marked + 1;
   pthread_mutex_lock(&space->object_tree_lock);
   struct large_object_node *node =
     large_object_tree_insert(&space->object_tree, k, v);
   uintptr_t node_bits = (uintptr_t)node;
   address_map_add(&space->object_map, addr, node_bits);
+  large_object_list_push(&space->nursery, node);
   space->total_pages += npages;
   pthread_mutex_unlock(&space->object_tree_lock);
   pthread_mutex_unlock(&space->lock);
@@ -491,16 +666,18 @@ large_object_space_init(struct large_object_space *space,
 
   large_object_tree_init(&space->object_tree);
   address_map_init(&space->object_map);
-  address_map_init(&space->nursery);
   large_object_freelist_init(&space->quarantine);
 
   address_set_init(&space->remembered_edges);
 
-  if (thread)
+  if (thread) {
+    gc_background_thread_add_task(thread, GC_BACKGROUND_TASK_START,
+                                  large_object_space_sweep_in_background,
+                                  space);
     gc_background_thread_add_task(thread, GC_BACKGROUND_TASK_START,
                                   large_object_space_process_quarantine,
                                   space);
-  else
+  } else
     space->synchronous_release = 1;
 
   return 1;
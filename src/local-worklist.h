@@ -2,6 +2,7 @@
 #define LOCAL_WORKLIST_H
 
 #include "assert.h"
+#include "compressed-ref.h"
 
 #define LOCAL_WORKLIST_SIZE 1024
 #define LOCAL_WORKLIST_MASK (LOCAL_WORKLIST_SIZE - 1)
@@ -9,7 +10,7 @@
 struct local_worklist {
   size_t read;
   size_t write;
-  struct gc_ref data[LOCAL_WORKLIST_SIZE];
+  struct compressed_ref data[LOCAL_WORKLIST_SIZE];
 };
 
 static inline void
@@ -33,19 +34,23 @@ local_worklist_full(struct local_worklist *q) {
   return local_worklist_size(q) >= LOCAL_WORKLIST_SIZE;
 }
 static inline void
-local_worklist_push(struct local_worklist *q, struct gc_ref v) {
+local_worklist_push(struct local_worklist *q, struct compressed_ref v) {
   ASSERT(!local_worklist_full(q));
   q->data[q->write++ & LOCAL_WORKLIST_MASK] = v;
 }
-static inline struct gc_ref
+// Pop the most recently pushed entry.  Tracing in LIFO order visits the
+// heap approximately depth-first, which for an evacuating collector
+// places objects next to their parents and siblings.  Entries shared
+// with other workers come from the other end, and are the oldest.
+static inline struct compressed_ref
 local_worklist_pop(struct local_worklist *q) {
   ASSERT(!local_worklist_empty(q));
-  return q->data[q->read++ & LOCAL_WORKLIST_MASK];
+  return q->data[--q->write & LOCAL_WORKLIST_MASK];
 }
 
 static inline size_t
-local_worklist_pop_many(struct local_worklist *q, struct gc_ref **objv,
-                        size_t limit) {
+local_worklist_pop_many(struct local_worklist *q,
+                        struct compressed_ref **objv, size_t limit) {
   size_t avail = local_worklist_size(q);
   size_t read = q->read & LOCAL_WORKLIST_MASK;
   size_t contig = LOCAL_WORKLIST_SIZE - read;
@@ -1,8 +1,11 @@
+#include <errno.h>
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "gc-api.h"
 
@@ -20,6 +23,7 @@
 #include "heap-sizer.h"
 #include "large-object-space.h"
 #include "nofl-space.h"
+#include "retention-paths.h"
 #if GC_PARALLEL
 #include "parallel-tracer.h"
 #else
@@ -30,6 +34,16 @@
 
 #define LARGE_OBJECT_THRESHOLD 8192
 
+// The writable data segments of loaded objects, which we treat as
+// conservative roots.  They only change when a shared object is loaded
+// or unloaded, so we keep them from one collection to the next.
+struct global_conservative_roots {
+  struct extent_range *ranges;
+  size_t count;
+  size_t capacity;
+  uint64_t generation;
+};
+
 struct gc_heap {
   struct nofl_space nofl_space;
   struct large_object_space large_object_space;
@@ -54,10 +68,15 @@ struct gc_heap {
   struct gc_mutator *mutators;
   long count;
   struct gc_tracer tracer;
+  struct global_conservative_roots global_roots;
+  struct retention_paths retention_paths;
+  int retention_report_interval;
+  int major_collections_since_retention_report;
   double fragmentation_low_threshold;
   double fragmentation_high_threshold;
   double minor_gc_yield_threshold;
   double major_gc_yield_threshold;
+  double remembered_set_limit;
   double minimum_major_gc_yield_threshold;
   double pending_ephemerons_size_factor;
   double pending_ephemerons_size_slop;
@@ -68,14 +87,22 @@ struct gc_heap {
 };
 
 #define HEAP_EVENT(heap, event, ...)                                    \
-  (heap)->event_listener.event((heap)->event_listener_data, ##__VA_ARGS__)
-#define MUTATOR_EVENT(mut, event, ...)                                  \
-  (mut)->heap->event_listener.event((mut)->event_listener_data, ##__VA_ARGS__)
+  GC_HEAP_EVENT((heap)->event_listener, (heap)->event_listener_data,    \
+                event, ##__VA_ARGS__)
+#define MUTATOR_EVENT(mut, event)                                       \
+  GC_MUTATOR_EVENT((mut)->heap->event_listener, (mut),                  \
+                   (mut)->event_listener_data, event)
 
 struct gc_mutator {
   struct nofl_allocator allocator;
+  struct nofl_allocator overflow;
+  struct nofl_allocator pointerless;
   struct gc_field_set_writer logger;
   struct gc_heap *heap;
+  uint64_t allocated_bytes;
+  uint64_t allocation_quota_base;
+  uint64_t allocation_quota;
+  uintptr_t allocation_mark;
   struct gc_stack stack;
   struct gc_mutator_roots *roots;
   void *event_listener_data;
@@ -85,6 +112,7 @@ struct gc_mutator {
 
 struct gc_trace_worker_data {
   struct nofl_allocator allocator;
+  uintptr_t retention_parent;
 };
 
 static inline struct nofl_space*
@@ -124,10 +152,40 @@ gc_trace_worker_call_with_data(void (*f)(struct gc_tracer *tracer,
                                struct gc_trace_worker *worker) {
   struct gc_trace_worker_data data;
   nofl_allocator_reset(&data.allocator);
+  data.retention_parent = 0;
   f(tracer, heap, worker, &data);
   nofl_allocator_finish(&data.allocator, heap_nofl_space(heap));
 }
 
+static inline struct extent_range
+gc_trace_compressible_range(struct gc_heap *heap) {
+  return nofl_space_bounds(heap_nofl_space(heap));
+}
+
+static inline int
+gc_trace_can_rescan(struct gc_heap *heap) {
+  return 1;
+}
+
+struct rescan_data {
+  struct gc_heap *heap;
+  struct gc_trace_worker *worker;
+};
+
+static void
+rescan_one(struct gc_ref ref, void *data) {
+  struct rescan_data *rescan = data;
+  trace_one(ref, rescan->heap, rescan->worker);
+}
+
+static void
+gc_trace_rescan_range(struct gc_heap *heap, struct gc_trace_worker *worker,
+                      uintptr_t lo, uintptr_t hi) {
+  struct rescan_data data = { heap, worker };
+  nofl_space_visit_marked_objects(heap_nofl_space(heap), lo, hi, rescan_one,
+                                  &data);
+}
+
 static inline int
 do_trace(struct gc_heap *heap, struct gc_edge edge, struct gc_ref ref,
          struct gc_trace_worker_data *data) {
@@ -196,12 +254,38 @@ all_mutators_stopped(struct gc_heap *heap) {
     heap->paused_mutator_count + heap->inactive_mutator_count;
 }
 
+// Bytes that a mutator bump-allocates inline are not counted as they
+// are allocated; instead the mutator remembers where its uncounted
+// allocations start, and tallies them up when it next leaves its
+// current hole.
+static void
+mutator_count_allocation(struct gc_mutator *mut) {
+  if (mut->allocation_mark) {
+    mut->allocated_bytes += mut->allocator.alloc - mut->allocation_mark;
+    mut->allocation_mark = 0;
+  }
+}
+
+static int
+mutator_exceeded_allocation_quota(struct gc_mutator *mut) {
+  return mut->allocation_quota
+    && (mut->allocated_bytes - mut->allocation_quota_base
+        > mut->allocation_quota);
+}
+
+static void
+reset_mutator_allocation_quotas(struct gc_heap *heap) {
+  for (struct gc_mutator *mut = heap->mutators; mut; mut = mut->next)
+    mut->allocation_quota_base = mut->allocated_bytes;
+}
+
 static void
 add_mutator(struct gc_heap *heap, struct gc_mutator *mut) {
   mut->heap = heap;
-  mut->event_listener_data =
-    heap->event_listener.mutator_added(heap->event_listener_data);
+  mut->event_listener_data = HEAP_EVENT(heap, mutator_added);
   nofl_allocator_reset(&mut->allocator);
+  nofl_allocator_reset(&mut->overflow);
+  nofl_allocator_reset(&mut->pointerless);
   gc_field_set_writer_init(&mut->logger, &heap->remembered_set);
   heap_lock(heap);
   // We have no roots.  If there is a GC currently in progress, we have
@@ -221,9 +305,12 @@ add_mutator(struct gc_heap *heap, struct gc_mutator *mut) {
 
 static void
 remove_mutator(struct gc_heap *heap, struct gc_mutator *mut) {
+  mutator_count_allocation(mut);
   nofl_allocator_finish(&mut->allocator, heap_nofl_space(heap));
+  nofl_allocator_finish(&mut->overflow, heap_nofl_space(heap));
+  nofl_allocator_finish(&mut->pointerless, heap_nofl_space(heap));
   if (GC_GENERATIONAL)
-    gc_field_set_writer_release_buffer(&mut->logger);
+    gc_field_set_writer_finish(&mut->logger);
   MUTATOR_EVENT(mut, mutator_removed);
   mut->heap = NULL;
   heap_lock(heap);
@@ -256,11 +343,28 @@ gc_heap_set_extern_space(struct gc_heap *heap, struct gc_extern_space *space) {
 
 static inline void tracer_visit(struct gc_edge edge, struct gc_heap *heap,
                                 void *trace_data) GC_ALWAYS_INLINE;
+static inline void
+set_retention_parent(struct gc_heap *heap, struct gc_trace_worker *worker,
+                     uintptr_t parent) {
+  if (GC_UNLIKELY(heap->retention_paths.recording))
+    gc_trace_worker_data(worker)->retention_parent = parent;
+}
+
+static inline void
+record_retention_parent(struct gc_heap *heap, struct gc_trace_worker *worker,
+                        struct gc_ref ref) {
+  if (GC_UNLIKELY(heap->retention_paths.recording))
+    retention_paths_record(&heap->retention_paths, ref,
+                           gc_trace_worker_data(worker)->retention_parent);
+}
+
 static inline void
 tracer_visit(struct gc_edge edge, struct gc_heap *heap, void *trace_data) {
   struct gc_trace_worker *worker = trace_data;
-  if (trace_edge(heap, edge, gc_trace_worker_data(worker)))
+  if (trace_edge(heap, edge, gc_trace_worker_data(worker))) {
+    record_retention_parent(heap, worker, gc_edge_ref(edge));
     gc_trace_worker_enqueue(worker, gc_edge_ref(edge));
+  }
 }
 
 static inline int
@@ -304,8 +408,10 @@ tracer_trace_conservative_ref(struct gc_conservative_ref ref,
                               struct gc_trace_worker *worker,
                               int possibly_interior) {
   struct gc_ref resolved = trace_conservative_ref(heap, ref, possibly_interior);
-  if (!gc_ref_is_null(resolved))
+  if (!gc_ref_is_null(resolved)) {
+    record_retention_parent(heap, worker, resolved);
     gc_trace_worker_enqueue(worker, resolved);
+  }
 }
 
 static inline struct gc_conservative_ref
@@ -340,6 +446,8 @@ trace_one_conservatively(struct gc_ref ref, struct gc_heap *heap,
                          worker);
       return;
     }
+    if (nofl_is_pointerless(ref))
+      return;
     bytes = nofl_space_object_size(heap_nofl_space(heap), ref);
   } else {
     bytes = large_object_space_object_size(heap_large_object_space(heap), ref);
@@ -353,6 +461,7 @@ trace_one_conservatively(struct gc_ref ref, struct gc_heap *heap,
 static inline void
 trace_one(struct gc_ref ref, struct gc_heap *heap,
           struct gc_trace_worker *worker) {
+  set_retention_parent(heap, worker, retention_parent_for_object(ref));
   if (gc_has_conservative_intraheap_edges())
     trace_one_conservatively(ref, heap, worker);
   else
@@ -362,6 +471,7 @@ trace_one(struct gc_ref ref, struct gc_heap *heap,
 static inline void
 trace_root(struct gc_root root, struct gc_heap *heap,
            struct gc_trace_worker *worker) {
+  set_retention_parent(heap, worker, retention_parent_for_root(root.kind));
   switch (root.kind) {
   case GC_ROOT_KIND_HEAP:
     gc_trace_heap_roots(root.heap->roots, tracer_visit, heap, worker);
@@ -388,6 +498,17 @@ trace_root(struct gc_root root, struct gc_heap *heap,
     gc_field_set_visit_edge_buffer(&heap->remembered_set, root.edge_buffer,
                                    trace_remembered_edge, heap, worker);
     break;
+  case GC_ROOT_KIND_MARKED_OBJECTS:
+    if (nofl_space_contains_address(heap_nofl_space(heap), root.range.lo_addr))
+      gc_trace_rescan_range(heap, worker, root.range.lo_addr,
+                            root.range.hi_addr);
+    else
+      trace_one(gc_ref(root.range.lo_addr), heap, worker);
+    break;
+  case GC_ROOT_KIND_EPHEMERON_SWEEP:
+    gc_sweep_pending_ephemerons(heap->pending_ephemerons, root.shard.index,
+                                root.shard.count);
+    break;
   default:
     GC_CRASH();
   }
@@ -496,6 +617,15 @@ heap_estimate_live_data_after_gc(struct gc_heap *heap,
     nofl_space_estimate_live_bytes_after_gc(heap_nofl_space(heap),
                                             last_yield)
     + large_object_space_size_at_last_collection(heap_large_object_space(heap));
+  // If there are pending unavailable bytes after GC, a large object is
+  // waiting for the nofl space to give up blocks.  It will be live as
+  // soon as it is allocated, so count it, giving the heap sizer a chance
+  // to make room for it.
+  ssize_t pending =
+    atomic_load_explicit(&heap_nofl_space(heap)->pending_unavailable_bytes,
+                         memory_order_acquire);
+  if (pending > 0)
+    bytes += pending;
   if (bytes < last_live_bytes)
     return last_live_bytes;
   return bytes;
@@ -527,9 +657,22 @@ clamp_major_gc_yield_threshold(struct gc_heap *heap, double threshold) {
   return threshold;
 }
 
+// Memory used by the remembered set, which is cleared at each
+// collection.  A minor collection visits each remembered edge.
+static size_t
+heap_remembered_set_size(struct gc_heap *heap) {
+  if (!GC_GENERATIONAL) return 0;
+  size_t lospace_edges =
+    large_object_space_remembered_edge_count(heap_large_object_space(heap));
+  return gc_field_set_active_buffer_count(&heap->remembered_set)
+    * sizeof(struct gc_edge_buffer)
+    + lospace_edges * sizeof(uintptr_t);
+}
+
 static enum gc_collection_kind
 determine_collection_kind(struct gc_heap *heap,
-                          enum gc_collection_kind requested) {
+                          enum gc_collection_kind requested,
+                          uintptr_t allocation_since_last_gc) {
   struct nofl_space *nofl_space = heap_nofl_space(heap);
   enum gc_collection_kind previous_gc_kind = atomic_load(&heap->gc_kind);
   enum gc_collection_kind gc_kind;
@@ -537,6 +680,12 @@ determine_collection_kind(struct gc_heap *heap,
   double fragmentation = heap_fragmentation(heap);
   ssize_t pending = atomic_load_explicit(&nofl_space->pending_unavailable_bytes,
                                          memory_order_acquire);
+  // The nursery is the space that the last collection left free.  A
+  // collection can come before the nursery fills up, for example if the
+  // user asks for one, so size it by capacity rather than by use.
+  size_t nursery_size = yield * heap->size_at_last_gc;
+  if (nursery_size < allocation_since_last_gc)
+    nursery_size = allocation_since_last_gc;
 
   if (heap->count == 0) {
     DEBUG("first collection is always major\n");
@@ -544,12 +693,6 @@ determine_collection_kind(struct gc_heap *heap,
   } else if (requested != GC_COLLECTION_ANY) {
     DEBUG("user specifically requested collection kind %d\n", (int)requested);
     gc_kind = requested;
-  } else if (pending > 0) {
-    DEBUG("evacuating due to need to reclaim %zd bytes\n", pending);
-    // During the last cycle, a large allocation could not find enough
-    // free blocks, and we decided not to expand the heap.  Let's do an
-    // evacuating major collection to maximize the free block yield.
-    gc_kind = GC_COLLECTION_COMPACTING;
   } else if (previous_gc_kind == GC_COLLECTION_COMPACTING
              && fragmentation >= heap->fragmentation_low_threshold) {
     DEBUG("continuing evacuation due to fragmentation %.2f%% > %.2f%%\n",
@@ -565,6 +708,13 @@ determine_collection_kind(struct gc_heap *heap,
           fragmentation * 100.,
           heap->fragmentation_high_threshold * 100.);
     gc_kind = GC_COLLECTION_COMPACTING;
+  } else if (pending > 0) {
+    DEBUG("major collection due to need to reclaim %zd bytes\n", pending);
+    // A large allocation could not find enough free blocks.  A major
+    // collection returns blocks whose objects have all died, and the
+    // heap sizer may then grow the heap to fit the allocation.  If that
+    // isn't enough, the allocating mutator will ask for compaction.
+    gc_kind = GC_COLLECTION_MAJOR;
   } else if (previous_gc_kind == GC_COLLECTION_COMPACTING) {
     // We were evacuating, but we're good now.  Go back to minor
     // collections.
@@ -584,6 +734,14 @@ determine_collection_kind(struct gc_heap *heap,
     DEBUG("collection yield too low, triggering major collection\n");
     // Nursery is getting tight; trigger a major GC.
     gc_kind = GC_COLLECTION_MAJOR;
+  } else if (heap_remembered_set_size(heap)
+             > heap->remembered_set_limit * nursery_size) {
+    DEBUG("remembered set of %zu bytes too large for nursery of %zu bytes, "
+          "triggering major collection\n", heap_remembered_set_size(heap),
+          nursery_size);
+    // A minor GC would spend more time on the remembered set than is
+    // warranted by the nursery size.
+    gc_kind = GC_COLLECTION_MAJOR;
   } else {
     DEBUG("keeping on with minor GC\n");
     // Nursery has adequate space; keep trucking with minor GCs.
@@ -635,12 +793,50 @@ enqueue_mutator_conservative_roots(struct gc_heap *heap) {
   return 0;
 }
 
+static void
+add_global_conservative_root(uintptr_t low, uintptr_t high,
+                             struct gc_heap *heap, void *unused) {
+  struct global_conservative_roots *roots = &heap->global_roots;
+  if (roots->count == roots->capacity) {
+    size_t capacity = roots->capacity ? roots->capacity * 2 : 16;
+    struct extent_range *ranges =
+      realloc(roots->ranges, capacity * sizeof(*ranges));
+    if (!ranges) {
+      perror("failed to grow global root set");
+      GC_CRASH();
+    }
+    roots->ranges = ranges;
+    roots->capacity = capacity;
+  }
+  roots->ranges[roots->count++] = (struct extent_range){ low, high };
+}
+
+static void
+update_global_conservative_roots(struct gc_heap *heap) {
+  if (!gc_has_global_conservative_roots())
+    return;
+  uint64_t generation = gc_platform_global_conservative_roots_generation();
+  if (generation == heap->global_roots.generation)
+    return;
+  heap->global_roots.count = 0;
+  heap->global_roots.generation = generation;
+  gc_platform_visit_global_conservative_roots(add_global_conservative_root,
+                                              heap, NULL);
+}
+
 static int
 enqueue_global_conservative_roots(struct gc_heap *heap) {
   if (gc_has_global_conservative_roots()) {
-    int possibly_interior = 0;
-    gc_platform_visit_global_conservative_roots
-      (enqueue_conservative_roots, heap, &possibly_interior);
+    // Usually the ranges are already up to date, but a mutator that was
+    // still running when we refreshed them may have loaded or unloaded
+    // an object before it stopped.
+    update_global_conservative_roots(heap);
+    for (size_t i = 0; i < heap->global_roots.count; i++) {
+      struct extent_range range = heap->global_roots.ranges[i];
+      gc_tracer_add_root(&heap->tracer,
+                         gc_root_conservative_edges(range.lo_addr,
+                                                    range.hi_addr, 0));
+    }
     return 1;
   }
   return 0;
@@ -659,12 +855,25 @@ enqueue_root_edge(struct gc_edge edge, struct gc_heap *heap, void *unused) {
   gc_tracer_add_root(&heap->tracer, gc_root_edge(edge));
 }
 
+static void
+enqueue_marked_objects(uintptr_t lo, uintptr_t hi, void *data) {
+  struct gc_heap *heap = data;
+  gc_tracer_add_root(&heap->tracer, gc_root_marked_objects(lo, hi));
+}
+
 static void
 enqueue_generational_roots(struct gc_heap *heap,
                            enum gc_collection_kind gc_kind) {
   if (!GC_GENERATIONAL) return;
-  if (gc_kind == GC_COLLECTION_MINOR)
+  if (gc_kind == GC_COLLECTION_MINOR) {
     gc_field_set_add_roots(&heap->remembered_set, &heap->tracer);
+    // Objects promoted by the last minor collection may refer to
+    // objects that it kept young.
+    nofl_space_visit_rescan_blocks(heap_nofl_space(heap),
+                                   enqueue_marked_objects, heap);
+    large_object_space_visit_promoted(heap_large_object_space(heap),
+                                      enqueue_marked_objects, heap);
+  }
 }
 
 static inline void
@@ -676,9 +885,28 @@ forget_remembered_edge(struct gc_edge edge, struct gc_heap *heap) {
   // cleared in bulk.
 }
 
+static inline int
+retain_remembered_edge(struct gc_edge edge, struct gc_heap *heap) {
+  struct nofl_space *space = heap_nofl_space(heap);
+  struct gc_ref ref = gc_edge_ref(edge);
+  if (!gc_ref_is_null(ref) && !gc_ref_is_immediate(ref)
+      && nofl_space_contains(space, ref) && nofl_space_is_young(space, ref))
+    return 1;
+  if (nofl_space_contains_edge(space, edge))
+    nofl_space_forget_edge(space, edge);
+  else
+    large_object_space_forget_edge(heap_large_object_space(heap), edge);
+  return 0;
+}
+
 static void
 clear_remembered_set(struct gc_heap *heap) {
   if (!GC_GENERATIONAL) return;
+  if (heap_nofl_space(heap)->aging) {
+    // Old objects may still refer to survivors that were kept young.
+    gc_field_set_retain(&heap->remembered_set, retain_remembered_edge, heap);
+    return;
+  }
   gc_field_set_clear(&heap->remembered_set, forget_remembered_edge, heap);
   large_object_space_clear_remembered_edges(heap_large_object_space(heap));
 }
@@ -721,6 +949,18 @@ trace_resolved_ephemerons(struct gc_heap *heap) {
   }
 }
 
+static int
+should_record_retention_paths(struct gc_heap *heap,
+                              enum gc_collection_kind gc_kind) {
+  if (!heap->retention_report_interval || gc_kind == GC_COLLECTION_MINOR)
+    return 0;
+  if (++heap->major_collections_since_retention_report
+      < heap->retention_report_interval)
+    return 0;
+  heap->major_collections_since_retention_report = 0;
+  return 1;
+}
+
 static void
 resolve_finalizers(struct gc_heap *heap) {
   for (size_t priority = 0;
@@ -735,9 +975,14 @@ resolve_finalizers(struct gc_heap *heap) {
   gc_notify_finalizers(heap->finalizer_state, heap);
 }
 
+// The pending ephemeron table is sized in proportion to the heap, so
+// sweep it with all trace workers.
 static void
 sweep_ephemerons(struct gc_heap *heap) {
-  return gc_sweep_pending_ephemerons(heap->pending_ephemerons, 0, 1);
+  size_t nshards = gc_tracer_worker_count(&heap->tracer);
+  for (size_t shard = 0; shard < nshards; shard++)
+    gc_tracer_add_root(&heap->tracer, gc_root_ephemeron_sweep(shard, nshards));
+  gc_tracer_trace_roots(&heap->tracer);
 }
 
 static void collect(struct gc_mutator *mut,
@@ -756,6 +1001,12 @@ collect(struct gc_mutator *mut, enum gc_collection_kind requested_kind,
   HEAP_EVENT(heap, requesting_stop);
   request_mutators_to_stop(heap);
   nofl_finish_sweeping(&mut->allocator, nofl_space);
+  // Until all mutators stop, a running mutator could hide a reference
+  // from the tracer by moving it to a root that was already traced, so
+  // we can't start tracing yet.  But we can do the work that doesn't
+  // depend on the mutators while the stragglers reach a safepoint.
+  gc_tracer_prepare(&heap->tracer);
+  update_global_conservative_roots(heap);
   HEAP_EVENT(heap, waiting_for_stop);
   wait_for_mutators_to_stop(heap);
   HEAP_EVENT(heap, mutators_stopped);
@@ -766,14 +1017,16 @@ collect(struct gc_mutator *mut, enum gc_collection_kind requested_kind,
   if (!requested_by_user)
     detect_out_of_memory(heap, allocation_counter);
   enum gc_collection_kind gc_kind =
-    determine_collection_kind(heap, requested_kind);
+    determine_collection_kind(heap, requested_kind, allocation_counter);
   int is_minor = gc_kind == GC_COLLECTION_MINOR;
+  int record_retention_paths = should_record_retention_paths(heap, gc_kind);
   HEAP_EVENT(heap, prepare_gc, gc_kind);
   nofl_space_prepare_gc(nofl_space, gc_kind);
   large_object_space_start_gc(lospace, is_minor);
   gc_extern_space_start_gc(exspace, is_minor);
   resolve_ephemerons_lazily(heap);
-  gc_tracer_prepare(&heap->tracer);
+  if (record_retention_paths)
+    retention_paths_start(&heap->retention_paths);
   double yield = heap_last_gc_yield(heap);
   double fragmentation = heap_fragmentation(heap);
   size_t live_bytes = heap->size * (1.0 - yield);
@@ -794,9 +1047,13 @@ collect(struct gc_mutator *mut, enum gc_collection_kind requested_kind,
   HEAP_EVENT(heap, ephemerons_traced);
   resolve_finalizers(heap);
   HEAP_EVENT(heap, finalizers_traced);
+  if (record_retention_paths)
+    retention_paths_finish(&heap->retention_paths, stderr, heap->count);
   sweep_ephemerons(heap);
   gc_tracer_release(&heap->tracer);
   clear_remembered_set(heap);
+  if (nofl_space->aging)
+    large_object_space_set_aside_promoted(lospace);
   nofl_space_finish_gc(nofl_space, gc_kind);
   large_object_space_finish_gc(lospace, is_minor);
   gc_extern_space_finish_gc(exspace, is_minor);
@@ -809,6 +1066,7 @@ collect(struct gc_mutator *mut, enum gc_collection_kind requested_kind,
   gc_heap_sizer_on_gc(heap->sizer, heap->size, live_bytes_estimate, pause_ns,
                       resize_heap);
   heap->size_at_last_gc = heap->size;
+  reset_mutator_allocation_quotas(heap);
   HEAP_EVENT(heap, restarting_mutators);
   allow_mutators_to_continue(heap);
 }
@@ -820,7 +1078,10 @@ trigger_collection(struct gc_mutator *mut,
   struct gc_heap *heap = mutator_heap(mut);
   int prev_kind = -1;
   gc_stack_capture_hot(&mut->stack);
+  mutator_count_allocation(mut);
   nofl_allocator_finish(&mut->allocator, heap_nofl_space(heap));
+  nofl_allocator_finish(&mut->overflow, heap_nofl_space(heap));
+  nofl_allocator_finish(&mut->pointerless, heap_nofl_space(heap));
   if (GC_GENERATIONAL)
     gc_field_set_writer_release_buffer(&mut->logger);
   heap_lock(heap);
@@ -844,8 +1105,12 @@ gc_safepoint_flag_loc(struct gc_mutator *mut) {
 void
 gc_safepoint_slow(struct gc_mutator *mut) {
   struct gc_heap *heap = mutator_heap(mut);
+  GC_PROBE(safepoint, mut);
   gc_stack_capture_hot(&mut->stack);
+  mutator_count_allocation(mut);
   nofl_allocator_finish(&mut->allocator, heap_nofl_space(heap));
+  nofl_allocator_finish(&mut->overflow, heap_nofl_space(heap));
+  nofl_allocator_finish(&mut->pointerless, heap_nofl_space(heap));
   if (GC_GENERATIONAL)
     gc_field_set_writer_release_buffer(&mut->logger);
   heap_lock(heap);
@@ -865,8 +1130,15 @@ allocate_large(struct gc_mutator *mut, size_t size) {
   nofl_space_request_release_memory(nofl_space,
                                     npages << lospace->page_size_log2);
 
-  while (!nofl_space_shrink(nofl_space, 0))
-    trigger_collection(mut, GC_COLLECTION_COMPACTING, 0);
+  // Making room for a large object starts by returning empty nofl
+  // blocks, and any excess of the evacuation reserve.  If that isn't
+  // enough, try a major collection, after which the heap sizer may grow
+  // the heap; only if there is still not enough room, compact.
+  enum gc_collection_kind kind = GC_COLLECTION_MAJOR;
+  while (!nofl_space_shrink(nofl_space, 0)) {
+    trigger_collection(mut, kind, 0);
+    kind = GC_COLLECTION_COMPACTING;
+  }
   atomic_fetch_add(&heap->large_object_pages, npages);
 
   void *ret = large_object_space_alloc(lospace, npages);
@@ -886,22 +1158,128 @@ collect_for_small_allocation(void *mut) {
   trigger_collection(mut, GC_COLLECTION_ANY, 0);
 }
 
+// How long a mutator over its allocation quota waits for the next
+// collection, at most, before allocating again.
+#define MUTATOR_THROTTLE_TIMEOUT_NS (1000 * 1000)
+
+// Park a mutator that is over its allocation quota until the next
+// collection, or for MUTATOR_THROTTLE_TIMEOUT_NS, whichever comes
+// first, so that the other mutators can get ahead.  The mutator is
+// inactive while it waits, so a collection needn't wait for it.  A
+// mutator that is the only active one doesn't wait, as it would just
+// delay the collection that resets its quota.  Either way the mutator
+// starts a new quota period, so it waits at most once per quota of
+// allocation, allocating about one quota per millisecond while others
+// run.
+static void
+throttle_mutator(struct gc_mutator *mut) GC_NEVER_INLINE;
+static void
+throttle_mutator(struct gc_mutator *mut) {
+  struct gc_heap *heap = mutator_heap(mut);
+  mut->allocation_quota_base = mut->allocated_bytes;
+  // Racy, but a stale count only means waiting once more or less.
+  size_t active =
+    atomic_load_explicit(&heap->mutator_count, memory_order_relaxed)
+    - atomic_load_explicit(&heap->inactive_mutator_count,
+                           memory_order_relaxed);
+  if (active <= 1)
+    return;
+
+  struct timespec deadline;
+  if (clock_gettime(CLOCK_MONOTONIC, &deadline)) {
+    perror("clock_gettime failed");
+    GC_CRASH();
+  }
+  deadline.tv_nsec += MUTATOR_THROTTLE_TIMEOUT_NS;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  gc_stack_capture_hot(&mut->stack);
+  mutator_count_allocation(mut);
+  nofl_allocator_finish(&mut->allocator, heap_nofl_space(heap));
+  nofl_allocator_finish(&mut->overflow, heap_nofl_space(heap));
+  nofl_allocator_finish(&mut->pointerless, heap_nofl_space(heap));
+  if (GC_GENERATIONAL)
+    gc_field_set_writer_release_buffer(&mut->logger);
+  heap_lock(heap);
+  long count = heap->count;
+  heap->inactive_mutator_count++;
+  if (all_mutators_stopped(heap))
+    pthread_cond_signal(&heap->collector_cond);
+  while (heap->count == count && !mutators_are_stopping(heap))
+    if (pthread_cond_timedwait(&heap->mutator_cond, &heap->lock,
+                               &deadline) == ETIMEDOUT)
+      break;
+  while (mutators_are_stopping(heap))
+    pthread_cond_wait(&heap->mutator_cond, &heap->lock);
+  heap->inactive_mutator_count--;
+  heap_unlock(heap);
+}
+
 void*
 gc_allocate_slow(struct gc_mutator *mut, size_t size) {
   GC_ASSERT(size > 0); // allocating 0 bytes would be silly
+  GC_PROBE(allocate_slow, mut, size);
 
-  if (size > gc_allocator_large_threshold())
+  mutator_count_allocation(mut);
+  if (mutator_exceeded_allocation_quota(mut))
+    throttle_mutator(mut);
+
+  if (size > gc_allocator_large_threshold()) {
+    mut->allocated_bytes += size;
     return allocate_large(mut, size);
+  }
 
-  return gc_ref_heap_object(nofl_allocate(&mut->allocator,
-                                          heap_nofl_space(mutator_heap(mut)),
-                                          size, collect_for_small_allocation,
-                                          mut));
+  struct nofl_space *nofl_space = heap_nofl_space(mutator_heap(mut));
+  struct gc_ref ret = nofl_allocate_overflow(&mut->allocator, &mut->overflow,
+                                             nofl_space, size);
+  if (!gc_ref_is_null(ret)) {
+    // Keep counting inline allocations in the current hole.
+    mut->allocated_bytes += align_up(size, NOFL_GRANULE_SIZE);
+    mut->allocation_mark = mut->allocator.alloc;
+    return gc_ref_heap_object(ret);
+  }
+
+  ret = nofl_allocate(&mut->allocator, nofl_space, size,
+                      collect_for_small_allocation, mut);
+  mut->allocation_mark = gc_ref_value(ret);
+  return gc_ref_heap_object(ret);
+}
+
+uint64_t
+gc_mutator_allocated_bytes(struct gc_mutator *mut) {
+  uint64_t ret = mut->allocated_bytes;
+  if (mut->allocation_mark)
+    ret += mut->allocator.alloc - mut->allocation_mark;
+  return ret;
+}
+
+void
+gc_mutator_set_allocation_quota(struct gc_mutator *mut, uint64_t bytes) {
+  mut->allocation_quota = bytes;
 }
 
 void*
 gc_allocate_pointerless(struct gc_mutator *mut, size_t size) {
-  return gc_allocate(mut, size);
+  // Pointerless blocks only save work if the heap is traced
+  // conservatively.
+  if (!gc_has_conservative_intraheap_edges()
+      || size > gc_allocator_large_threshold())
+    return gc_allocate(mut, size);
+
+  if (mutator_exceeded_allocation_quota(mut))
+    throttle_mutator(mut);
+
+  struct nofl_space *nofl_space = heap_nofl_space(mutator_heap(mut));
+  struct gc_ref ret = nofl_allocate_pointerless(&mut->pointerless, nofl_space,
+                                                size);
+  if (gc_ref_is_null(ret))
+    return gc_allocate(mut, size);
+
+  mut->allocated_bytes += align_up(size, NOFL_GRANULE_SIZE);
+  return gc_ref_heap_object(ret);
 }
 
 void
@@ -1059,7 +1437,11 @@ static uint64_t allocation_counter_from_thread(struct gc_heap *heap) {
 
 static void set_heap_size_from_thread(struct gc_heap *heap, size_t size) {
   if (pthread_mutex_trylock(&heap->lock)) return;
-  resize_heap(heap, size);
+  // A collection that is waiting for mutators to stop has already
+  // prepared the tracer for the current extent of the heap; it will
+  // resize the heap itself when it finishes.
+  if (!mutators_are_stopping(heap))
+    resize_heap(heap, size);
   pthread_mutex_unlock(&heap->lock);
 }
 
@@ -1069,11 +1451,18 @@ heap_init(struct gc_heap *heap, const struct gc_options *options) {
 
   gc_field_set_init(&heap->remembered_set);
   pthread_mutex_init(&heap->lock, NULL);
-  pthread_cond_init(&heap->mutator_cond, NULL);
+  // Throttled mutators wait on mutator_cond with a monotonic deadline.
+  pthread_condattr_t cond_attr;
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&heap->mutator_cond, &cond_attr);
+  pthread_condattr_destroy(&cond_attr);
   pthread_cond_init(&heap->collector_cond, NULL);
   heap->size = heap->size_at_last_gc = options->common.heap_size;
 
-  if (!gc_tracer_init(&heap->tracer, heap, options->common.parallelism))
+  if (!gc_tracer_init(&heap->tracer, heap, options->common.parallelism,
+                      options->common.trace_worker_idle_timeout,
+                      options->common.trace_worklist_max_log_size))
     GC_CRASH();
 
   heap->pending_ephemerons_size_factor = 0.005;
@@ -1084,6 +1473,9 @@ heap_init(struct gc_heap *heap, const struct gc_options *options) {
   heap->minimum_major_gc_yield_threshold = 0.05;
   heap->major_gc_yield_threshold =
     clamp_major_gc_yield_threshold(heap, heap->minor_gc_yield_threshold);
+  heap->remembered_set_limit = options->common.remembered_set_limit;
+  heap->retention_report_interval = options->common.retention_report_interval;
+  retention_paths_init(&heap->retention_paths);
 
   if (!heap_prepare_pending_ephemerons(heap))
     GC_CRASH();
@@ -1137,6 +1529,7 @@ gc_init(const struct gc_options *options, struct gc_stack_addr *stack_base,
   if (!nofl_space_init(space, (*heap)->size,
                        options->common.parallelism != 1,
                        (*heap)->fragmentation_low_threshold,
+                       options->common.promotion_age,
                        (*heap)->background_thread)) {
     free(*heap);
     *heap = NULL;
@@ -1177,7 +1570,10 @@ gc_finish_for_thread(struct gc_mutator *mut) {
 static void
 deactivate_mutator(struct gc_heap *heap, struct gc_mutator *mut) {
   GC_ASSERT(mut->next == NULL);
+  mutator_count_allocation(mut);
   nofl_allocator_finish(&mut->allocator, heap_nofl_space(heap));
+  nofl_allocator_finish(&mut->overflow, heap_nofl_space(heap));
+  nofl_allocator_finish(&mut->pointerless, heap_nofl_space(heap));
   if (GC_GENERATIONAL)
     gc_field_set_writer_release_buffer(&mut->logger);
   heap_lock(heap);
@@ -19,6 +19,7 @@
 #include "gc-inline.h"
 #include "gc-lock.h"
 #include "gc-platform.h"
+#include "gc-probe.h"
 #include "spin.h"
 #include "swar.h"
 
@@ -79,8 +80,8 @@ enum nofl_block_summary_flag {
   NOFL_BLOCK_UNAVAILABLE = 0x4,
   NOFL_BLOCK_PAGED_OUT = 0x8,
   NOFL_BLOCK_FLAG_UNUSED_3 = 0x8,
-  NOFL_BLOCK_FLAG_UNUSED_4 = 0x10,
-  NOFL_BLOCK_FLAG_UNUSED_5 = 0x20,
+  NOFL_BLOCK_AGED = 0x10,
+  NOFL_BLOCK_POINTERLESS = 0x20,
   NOFL_BLOCK_FLAG_UNUSED_6 = 0x40,
   NOFL_BLOCK_FLAG_UNUSED_7 = 0x80,
   NOFL_BLOCK_FLAG_UNUSED_8 = 0x100,
@@ -124,10 +125,24 @@ struct nofl_block_ref {
   uintptr_t addr;
 };
 
+// For each block, how many granules were occupied by objects that could
+// not be moved: conservatively-referenced or pinned objects.  The
+// current cycle's counts accumulate as objects are marked; when a major
+// collection starts they roll over to last_pinned_granules.  Minor
+// collections add to the counts too, and can count space that has since
+// been freed and reused, so counts saturate at the block size.  Like the
+// summaries and block marks, these are indexed by block index within
+// the slab, so the entries for the metadata blocks are unused.
+#define NOFL_PINNED_GRANULES_BYTES_PER_SLAB \
+  (2 * NOFL_BLOCKS_PER_SLAB * sizeof(uint16_t))
+
 struct nofl_slab {
   struct nofl_slab_header header;
   struct nofl_block_summary summaries[NOFL_NONMETA_BLOCKS_PER_SLAB];
-  uint8_t unused[NOFL_VESTIGIAL_BYTES_PER_SLAB];
+  uint16_t pinned_granules[NOFL_BLOCKS_PER_SLAB];
+  uint16_t last_pinned_granules[NOFL_BLOCKS_PER_SLAB];
+  uint8_t unused[NOFL_VESTIGIAL_BYTES_PER_SLAB
+                 - NOFL_PINNED_GRANULES_BYTES_PER_SLAB];
   uint8_t metadata[NOFL_METADATA_BYTES_PER_SLAB];
   struct nofl_block blocks[NOFL_NONMETA_BLOCKS_PER_SLAB];
 };
@@ -169,13 +184,32 @@ struct nofl_space {
   double evacuation_minimum_reserve;
   double evacuation_reserve;
   double promotion_threshold;
+  // How many minor collections a young object has to survive before it
+  // is promoted, and whether the current collection keeps survivors
+  // young.  See nofl_space_should_keep_young.
+  int promotion_age;
+  uint8_t aging;
+  // Blocks in which the last minor collection promoted objects that had
+  // been kept young; see nofl_space_age_block.
+  uintptr_t *rescan_blocks;
+  size_t rescan_block_count;
+  size_t rescan_block_capacity;
   ssize_t pending_unavailable_bytes; // atomically
   struct nofl_slab **slabs;
   size_t nslabs;
+  // Blocks of the initial slabs that have never been handed out.  Their
+  // summaries are initialized lazily, when the block is first popped
+  // from the empty set, so that startup costs don't scale with heap
+  // size.
+  struct nofl_slab *fresh_slabs;
+  size_t next_fresh_block;
+  size_t fresh_block_limit;
   uintptr_t old_generation_granules; // atomically
   uintptr_t survivor_granules_at_last_collection; // atomically
   uintptr_t allocated_granules_since_last_collection; // atomically
   uintptr_t fragmentation_granules_since_last_collection; // atomically
+  uintptr_t evacuated_granules; // atomically
+  uint8_t evacuation_truncated; // atomically
 };
 
 struct nofl_allocator {
@@ -298,6 +332,43 @@ nofl_block_set_mark(uintptr_t addr) {
 
 #define NOFL_GRANULES_PER_BLOCK (NOFL_BLOCK_SIZE / NOFL_GRANULE_SIZE)
 
+static uint16_t*
+nofl_block_pinned_granules_loc(uintptr_t addr) {
+  uintptr_t base = align_down(addr, NOFL_SLAB_SIZE);
+  struct nofl_slab *slab = (struct nofl_slab *) base;
+  unsigned block_idx = (addr / NOFL_BLOCK_SIZE) % NOFL_BLOCKS_PER_SLAB;
+  return &slab->pinned_granules[block_idx];
+}
+
+static void
+nofl_block_add_pinned_granules(uintptr_t addr, size_t granules) {
+  uint16_t *loc = nofl_block_pinned_granules_loc(addr);
+  uint16_t old = atomic_load_explicit(loc, memory_order_relaxed);
+  uint16_t new;
+  do {
+    if (old >= NOFL_GRANULES_PER_BLOCK)
+      return;
+    size_t sum = old + granules;
+    new = sum < NOFL_GRANULES_PER_BLOCK ? sum : NOFL_GRANULES_PER_BLOCK;
+  } while (!atomic_compare_exchange_weak_explicit(loc, &old, new,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed));
+}
+
+// Estimate of how many granules in a block will stay put if we try to
+// evacuate it: the larger of what the last major collection found, and
+// what this collection has found so far (pinned roots are traced before
+// choosing evacuation candidates).
+static size_t
+nofl_block_pinned_granules(uintptr_t addr) {
+  uintptr_t base = align_down(addr, NOFL_SLAB_SIZE);
+  struct nofl_slab *slab = (struct nofl_slab *) base;
+  unsigned block_idx = (addr / NOFL_BLOCK_SIZE) % NOFL_BLOCKS_PER_SLAB;
+  size_t last = slab->last_pinned_granules[block_idx];
+  size_t current = slab->pinned_granules[block_idx];
+  return last > current ? last : current;
+}
+
 static struct nofl_block_summary*
 nofl_block_summary_for_addr(uintptr_t addr) {
   uintptr_t base = align_down(addr, NOFL_SLAB_SIZE);
@@ -500,20 +571,6 @@ nofl_push_empty_block(struct nofl_space *space,
   nofl_block_stack_push(&space->empty, block, lock);
 }
 
-static struct nofl_block_ref
-nofl_pop_empty_block_with_lock(struct nofl_space *space,
-                               const struct gc_lock *lock) {
-  return nofl_block_stack_pop(&space->empty, lock);
-}
-
-static struct nofl_block_ref
-nofl_pop_empty_block(struct nofl_space *space) {
-  struct gc_lock lock = nofl_space_lock(space);
-  struct nofl_block_ref ret = nofl_pop_empty_block_with_lock(space, &lock);
-  gc_lock_release(&lock);
-  return ret;
-}
-
 static size_t
 nofl_active_block_count(struct nofl_space *space) {
   size_t total = space->nslabs * NOFL_NONMETA_BLOCKS_PER_SLAB;
@@ -551,6 +608,50 @@ nofl_push_evacuation_target_if_possible(struct nofl_space *space,
                                            space->evacuation_reserve);
 }
 
+static size_t
+nofl_fresh_block_count(struct nofl_space *space) {
+  return space->fresh_block_limit - space->next_fresh_block;
+}
+
+static struct nofl_block_ref
+nofl_pop_fresh_block(struct nofl_space *space, const struct gc_lock *lock) {
+  while (space->next_fresh_block < space->fresh_block_limit) {
+    size_t idx = space->next_fresh_block++;
+    struct nofl_slab *slab =
+      &space->fresh_slabs[idx / NOFL_NONMETA_BLOCKS_PER_SLAB];
+    uintptr_t addr =
+      (uintptr_t)slab->blocks[idx % NOFL_NONMETA_BLOCKS_PER_SLAB].data;
+    struct nofl_block_ref block = nofl_block_for_addr(addr);
+    nofl_block_set_flag(block, NOFL_BLOCK_ZERO | NOFL_BLOCK_PAGED_OUT);
+    // As fresh blocks are reached, top up the evacuation reserve first.
+    if (!nofl_push_evacuation_target_if_needed(space, block))
+      return block;
+  }
+  return nofl_block_null();
+}
+
+static size_t
+nofl_empty_block_count(struct nofl_space *space) {
+  return nofl_block_count(&space->empty.list) + nofl_fresh_block_count(space);
+}
+
+static struct nofl_block_ref
+nofl_pop_empty_block_with_lock(struct nofl_space *space,
+                               const struct gc_lock *lock) {
+  struct nofl_block_ref block = nofl_block_stack_pop(&space->empty, lock);
+  if (nofl_block_is_null(block))
+    block = nofl_pop_fresh_block(space, lock);
+  return block;
+}
+
+static struct nofl_block_ref
+nofl_pop_empty_block(struct nofl_space *space) {
+  struct gc_lock lock = nofl_space_lock(space);
+  struct nofl_block_ref ret = nofl_pop_empty_block_with_lock(space, &lock);
+  gc_lock_release(&lock);
+  return ret;
+}
+
 static inline void
 nofl_clear_memory(uintptr_t addr, size_t size) {
   memset((char*)addr, 0, size);
@@ -578,6 +679,16 @@ nofl_should_promote_block(struct nofl_space *space,
   return block.summary->hole_granules < threshold;
 }
 
+// Objects in an aged block that still have their young bit survived the
+// last minor collection, so the sweeper has to leave them be.
+static uintptr_t
+nofl_block_sweep_mask(struct nofl_space *space, struct nofl_block_ref block) {
+  uintptr_t mask = space->sweep_mask;
+  if (GC_GENERATIONAL && nofl_block_has_flag(block, NOFL_BLOCK_AGED))
+    mask |= broadcast_byte(NOFL_METADATA_BYTE_YOUNG);
+  return mask;
+}
+
 static void
 nofl_allocator_release_full_block(struct nofl_allocator *alloc,
                                   struct nofl_space *space) {
@@ -591,9 +702,13 @@ nofl_allocator_release_full_block(struct nofl_allocator *alloc,
   atomic_fetch_add(&space->fragmentation_granules_since_last_collection,
                    block.summary->fragmentation_granules);
 
-  if (nofl_should_promote_block(space, block))
+  if (nofl_should_promote_block(space, block)) {
+    // Any young object in a block on its way to the old generation is
+    // promoted by the next minor collection.
+    if (space->promotion_age > 1)
+      nofl_block_set_flag(block, NOFL_BLOCK_AGED);
     nofl_block_list_push(&space->promoted, block);
-  else
+  } else
     nofl_block_list_push(&space->full, block);
 
   nofl_allocator_reset(alloc);
@@ -612,6 +727,8 @@ nofl_allocator_release_full_evacuation_target(struct nofl_allocator *alloc,
   GC_ASSERT_EQ(block.summary->hole_granules, NOFL_GRANULES_PER_BLOCK);
   atomic_fetch_add(&space->old_generation_granules,
                    NOFL_GRANULES_PER_BLOCK);
+  atomic_fetch_add(&space->evacuated_granules,
+                   (alloc->alloc - block.addr) >> NOFL_GRANULE_SIZE_LOG_2);
   if (hole_size) {
     hole_size >>= NOFL_GRANULE_SIZE_LOG_2;
     block.summary->holes_with_fragmentation = 1;
@@ -652,6 +769,7 @@ nofl_allocator_acquire_partly_full_block(struct nofl_allocator *alloc,
   if (nofl_block_is_null(block))
     return 0;
   GC_ASSERT_EQ(block.summary->holes_with_fragmentation, 0);
+  nofl_block_clear_flag(block, NOFL_BLOCK_POINTERLESS);
   alloc->block = block;
   alloc->sweep = block.addr + NOFL_BLOCK_SIZE;
   size_t hole_granules = block.summary->fragmentation_granules;
@@ -670,6 +788,7 @@ nofl_allocator_acquire_empty_block(struct nofl_allocator *alloc,
   block.summary->hole_granules = NOFL_GRANULES_PER_BLOCK;
   block.summary->holes_with_fragmentation = 0;
   block.summary->fragmentation_granules = 0;
+  nofl_block_clear_flag(block, NOFL_BLOCK_POINTERLESS);
   alloc->block = block;
   alloc->alloc = block.addr;
   alloc->sweep = block.addr + NOFL_BLOCK_SIZE;
@@ -771,7 +890,8 @@ nofl_allocator_release_block(struct nofl_allocator *alloc,
   } else if (space->evacuating) {
     nofl_allocator_release_full_evacuation_target(alloc, space);
   } else {
-    nofl_allocator_finish_sweeping_in_block(alloc, space->sweep_mask);
+    uintptr_t sweep_mask = nofl_block_sweep_mask(space, alloc->block);
+    nofl_allocator_finish_sweeping_in_block(alloc, sweep_mask);
     nofl_allocator_release_full_block(alloc, space);
   }
 }
@@ -788,6 +908,7 @@ nofl_allocator_acquire_block_to_sweep(struct nofl_allocator *alloc,
   struct nofl_block_ref block = nofl_block_list_pop(&space->to_sweep);
   if (nofl_block_is_null(block))
     return 0;
+  nofl_block_clear_flag(block, NOFL_BLOCK_POINTERLESS);
   alloc->block = block;
   alloc->alloc = alloc->sweep = block.addr;
   return 1;
@@ -800,8 +921,8 @@ nofl_allocator_next_hole(struct nofl_allocator *alloc,
 
   // Sweep current block for a hole.
   if (nofl_allocator_has_block(alloc)) {
-    size_t granules =
-      nofl_allocator_next_hole_in_block(alloc, space->sweep_mask);
+    uintptr_t sweep_mask = nofl_block_sweep_mask(space, alloc->block);
+    size_t granules = nofl_allocator_next_hole_in_block(alloc, sweep_mask);
     if (granules)
       return granules;
     else
@@ -818,8 +939,8 @@ nofl_allocator_next_hole(struct nofl_allocator *alloc,
     alloc->block.summary->hole_granules = 0;
     alloc->block.summary->holes_with_fragmentation = 0;
     alloc->block.summary->fragmentation_granules = 0;
-    size_t granules =
-      nofl_allocator_next_hole_in_block(alloc, space->sweep_mask);
+    uintptr_t sweep_mask = nofl_block_sweep_mask(space, alloc->block);
+    size_t granules = nofl_allocator_next_hole_in_block(alloc, sweep_mask);
     if (granules)
       return granules;
     nofl_allocator_release_full_block(alloc, space);
@@ -850,6 +971,7 @@ nofl_allocate(struct nofl_allocator *alloc, struct nofl_space *space,
     size_t granules = size >> NOFL_GRANULE_SIZE_LOG_2;
     while (1) {
       size_t hole = nofl_allocator_next_hole(alloc, space);
+      GC_PROBE(next_hole, granules, hole);
       if (hole >= granules) {
         break;
       }
@@ -864,6 +986,119 @@ nofl_allocate(struct nofl_allocator *alloc, struct nofl_space *space,
   return ret;
 }
 
+// Find a hole of at least GRANULES granules for an overflow region.
+// Try the rest of the overflow block first, then the next partly-full
+// block if its hole is big enough, then blocks to sweep, and only then
+// an empty block, so that medium objects don't use up the empty blocks.
+// Holes that are too small are skipped, as nofl_allocate would do.  The
+// tail of the previous overflow block goes back on the partly-full
+// list.  Return 0 if there is no such hole.
+static int
+nofl_allocator_acquire_overflow_hole(struct nofl_allocator *overflow,
+                                     struct nofl_space *space,
+                                     size_t granules) {
+  if (nofl_allocator_has_block(overflow)
+      && overflow->sweep < overflow->block.addr + NOFL_BLOCK_SIZE) {
+    uintptr_t sweep_mask = nofl_block_sweep_mask(space, overflow->block);
+    size_t hole;
+    do {
+      nofl_allocator_finish_hole(overflow);
+      hole = nofl_allocator_next_hole_in_block(overflow, sweep_mask);
+    } while (hole && hole < granules);
+    if (hole)
+      return 1;
+    nofl_allocator_release_full_block(overflow, space);
+  }
+
+  struct nofl_allocator fresh;
+  nofl_allocator_reset(&fresh);
+  size_t hole = nofl_allocator_acquire_partly_full_block(&fresh, space);
+  if (hole && hole < granules) {
+    nofl_allocator_release_partly_full_block(&fresh, space);
+    hole = 0;
+  }
+  while (!hole && nofl_allocator_acquire_block_to_sweep(&fresh, space)) {
+    fresh.block.summary->hole_count = 0;
+    fresh.block.summary->hole_granules = 0;
+    fresh.block.summary->holes_with_fragmentation = 0;
+    fresh.block.summary->fragmentation_granules = 0;
+    uintptr_t sweep_mask = nofl_block_sweep_mask(space, fresh.block);
+    do {
+      nofl_allocator_finish_hole(&fresh);
+      hole = nofl_allocator_next_hole_in_block(&fresh, sweep_mask);
+    } while (hole && hole < granules);
+    if (!hole)
+      nofl_allocator_release_full_block(&fresh, space);
+  }
+  if (!hole && !nofl_allocator_acquire_empty_block(&fresh, space))
+    return 0;
+
+  if (nofl_allocator_has_block(overflow))
+    nofl_allocator_release_block(overflow, space);
+  *overflow = fresh;
+  return 1;
+}
+
+// If a medium-sized object doesn't fit in the current hole, moving on
+// to the next hole would abandon the rest of this one, and perhaps
+// several small holes after it.  Instead, as in Immix, bump-allocate
+// such objects in a separate overflow region, leaving the holes to small
+// objects.  Return null if the object is small or fits in the current
+// hole, if there is no current hole to save, or if there is no room for
+// an overflow region; the caller should then fall back to
+// nofl_allocate.
+static struct gc_ref
+nofl_allocate_overflow(struct nofl_allocator *alloc,
+                       struct nofl_allocator *overflow,
+                       struct nofl_space *space, size_t size) {
+  GC_ASSERT(size > 0);
+  GC_ASSERT(size <= gc_allocator_large_threshold());
+  size = align_up(size, NOFL_GRANULE_SIZE);
+
+  if (size < NOFL_MEDIUM_OBJECT_THRESHOLD
+      || alloc->alloc == alloc->sweep
+      || alloc->alloc + size <= alloc->sweep)
+    return gc_ref_null();
+
+  if (overflow->alloc + size > overflow->sweep
+      && !nofl_allocator_acquire_overflow_hole(overflow, space,
+                                               size >> NOFL_GRANULE_SIZE_LOG_2))
+    return gc_ref_null();
+
+  struct gc_ref ret = gc_ref(overflow->alloc);
+  overflow->alloc += size;
+  gc_update_alloc_table(ret, size);
+  return ret;
+}
+
+// With conservative heap scanning, every word of a marked object is
+// treated as a possible reference, even if the embedder knows that the
+// object contains no pointers.  So that tracing can skip them, such
+// objects get their own blocks, taken from the empty list and flagged
+// as pointerless.  Any other use of a block clears the flag.  Return
+// null if there are no empty blocks; the caller should then fall back
+// to nofl_allocate.
+static struct gc_ref
+nofl_allocate_pointerless(struct nofl_allocator *alloc,
+                          struct nofl_space *space, size_t size) {
+  GC_ASSERT(size > 0);
+  GC_ASSERT(size <= gc_allocator_large_threshold());
+  size = align_up(size, NOFL_GRANULE_SIZE);
+
+  if (alloc->alloc + size > alloc->sweep) {
+    if (nofl_allocator_has_block(alloc))
+      nofl_allocator_release_block(alloc, space);
+    if (!nofl_allocator_acquire_empty_block(alloc, space))
+      return gc_ref_null();
+    nofl_block_set_flag(alloc->block, NOFL_BLOCK_POINTERLESS);
+  }
+
+  struct gc_ref ret = gc_ref(alloc->alloc);
+  alloc->alloc += size;
+  gc_update_alloc_table(ret, size);
+  return ret;
+}
+
 static struct gc_ref
 nofl_evacuation_allocate(struct nofl_allocator* alloc, struct nofl_space *space,
                          size_t granules) {
@@ -897,6 +1132,12 @@ nofl_is_ephemeron(struct gc_ref ref) {
   return meta & NOFL_METADATA_BYTE_EPHEMERON;
 }
 
+static inline int
+nofl_is_pointerless(struct gc_ref ref) {
+  return nofl_block_has_flag(nofl_block_for_addr(gc_ref_value(ref)),
+                             NOFL_BLOCK_POINTERLESS);
+}
+
 static void
 nofl_space_set_ephemeron_flag(struct gc_ref ref) {
   if (gc_has_conservative_intraheap_edges()) {
@@ -912,6 +1153,11 @@ nofl_space_contains_address(struct nofl_space *space, uintptr_t addr) {
   return extents_contain_addr(space->extents, addr);
 }
 
+static inline struct extent_range
+nofl_space_bounds(struct nofl_space *space) {
+  return extents_bounds(space->extents);
+}
+
 static inline int
 nofl_space_contains_conservative_ref(struct nofl_space *space,
                                      struct gc_conservative_ref ref) {
@@ -937,6 +1183,13 @@ nofl_space_is_survivor(struct nofl_space *space, struct gc_ref ref) {
   return byte & mask;
 }
 
+static inline int
+nofl_space_is_young(struct nofl_space *space, struct gc_ref ref) {
+  uint8_t *metadata = nofl_metadata_byte_for_object(ref);
+  uint8_t byte = atomic_load_explicit(metadata, memory_order_relaxed);
+  return byte & NOFL_METADATA_BYTE_YOUNG;
+}
+
 static uint8_t*
 nofl_field_logged_byte(struct gc_edge edge) {
   return nofl_metadata_byte_for_addr(gc_edge_address(edge));
@@ -1025,15 +1278,7 @@ nofl_space_estimate_live_bytes_after_gc(struct nofl_space *space,
   bytes +=
     nofl_block_count(&space->to_sweep) * NOFL_BLOCK_SIZE * (1 - last_yield);
 
-  DEBUG("--- nofl estimate before adjustment: %zu\n", bytes);
-/*
-  // Assume that if we have pending unavailable bytes after GC that there is a
-  // large object waiting to be allocated, and that probably it survives this GC
-  // cycle.
-  bytes += atomic_load_explicit(&space->pending_unavailable_bytes,
-                                memory_order_acquire);
-  DEBUG("--- nofl estimate after adjustment: %zu\n", bytes);
-*/
+  DEBUG("--- nofl estimate: %zu\n", bytes);
   return bytes;
 }
 
@@ -1055,6 +1300,8 @@ nofl_space_fragmentation(struct nofl_space *space) {
 static void
 nofl_space_prepare_evacuation(struct nofl_space *space) {
   GC_ASSERT(!space->evacuating);
+  space->evacuated_granules = 0;
+  space->evacuation_truncated = 0;
   struct nofl_block_ref block;
   struct gc_lock lock = nofl_space_lock(space);
   while (!nofl_block_is_null
@@ -1067,7 +1314,7 @@ nofl_space_prepare_evacuation(struct nofl_space *space) {
   GC_ASSERT_EQ(nofl_block_count(&space->promoted), 0);
   GC_ASSERT_EQ(nofl_block_count(&space->old), 0);
   GC_ASSERT_EQ(nofl_block_count(&space->evacuation_targets), 0);
-  size_t target_blocks = nofl_block_count(&space->empty.list);
+  size_t target_blocks = nofl_empty_block_count(space);
   DEBUG("evacuation target block count: %zu\n", target_blocks);
 
   if (target_blocks == 0) {
@@ -1086,14 +1333,31 @@ nofl_space_prepare_evacuation(struct nofl_space *space) {
   // range is number of blocks in that bucket.  (Bucket 0 is for blocks
   // that were found to be completely empty; such blocks may be on the
   // evacuation target list.)
-  const size_t bucket_count = 33;
-  size_t histogram[33] = {0,};
+  //
+  // A block with pinned objects won't be freed by evacuation: moving its
+  // other survivors just trades their space for the same amount of
+  // space in the target blocks.  So, per granule of evacuation reserve,
+  // such a block reclaims no more than a completely full block.  These
+  // blocks go in an extra bucket 33, ranked after all others, and are
+  // charged for their movable granules only.
+  const size_t bucket_count = 34;
+  const size_t pinned_bucket = 33;
+  size_t histogram[34] = {0,};
   size_t bucket_size = NOFL_GRANULES_PER_BLOCK / 32;
+  size_t pinned_movable_granules = 0;
   for (struct nofl_block_ref b = nofl_block_for_addr(space->to_sweep.blocks);
        !nofl_block_is_null(b);
        b = nofl_block_next(b)) {
     size_t survivor_granules = NOFL_GRANULES_PER_BLOCK - b.summary->hole_granules;
-    size_t bucket = (survivor_granules + bucket_size - 1) / bucket_size;
+    size_t pinned_granules = nofl_block_pinned_granules(b.addr);
+    size_t bucket;
+    if (pinned_granules) {
+      if (pinned_granules < survivor_granules)
+        pinned_movable_granules += survivor_granules - pinned_granules;
+      bucket = pinned_bucket;
+    } else {
+      bucket = (survivor_granules + bucket_size - 1) / bucket_size;
+    }
     histogram[bucket]++;
   }
 
@@ -1101,29 +1365,36 @@ nofl_space_prepare_evacuation(struct nofl_space *space) {
   // the target blocks.  Prefer candidate blocks with fewer survivors
   // from the last GC, to increase expected free block yield.
   for (size_t bucket = 0; bucket < bucket_count; bucket++) {
-    size_t bucket_granules = bucket * bucket_size * histogram[bucket];
+    size_t bucket_granules = bucket == pinned_bucket
+      ? pinned_movable_granules
+      : bucket * bucket_size * histogram[bucket];
     if (bucket_granules <= target_granules) {
       target_granules -= bucket_granules;
     } else {
-      histogram[bucket] = target_granules / (bucket_size * bucket);
+      histogram[bucket] = target_granules * histogram[bucket] / bucket_granules;
       target_granules = 0;
     }
   }
 
   // Having selected the number of blocks, now we set the evacuation
   // candidate flag on all blocks that have live objects.
+  size_t candidate_count = 0;
   for (struct nofl_block_ref b = nofl_block_for_addr(space->to_sweep.blocks);
        !nofl_block_is_null(b);
        b = nofl_block_next(b)) {
     size_t survivor_granules = NOFL_GRANULES_PER_BLOCK - b.summary->hole_granules;
-    size_t bucket = (survivor_granules + bucket_size - 1) / bucket_size;
+    size_t bucket = nofl_block_pinned_granules(b.addr)
+      ? pinned_bucket
+      : (survivor_granules + bucket_size - 1) / bucket_size;
     if (histogram[bucket]) {
       nofl_block_set_flag(b, NOFL_BLOCK_EVACUATE);
       histogram[bucket]--;
+      candidate_count++;
     } else {
       nofl_block_clear_flag(b, NOFL_BLOCK_EVACUATE);
     }
   }
+  GC_PROBE(evacuation_candidates, target_blocks, candidate_count);
 }
 
 static void
@@ -1145,12 +1416,29 @@ nofl_space_clear_block_marks(struct nofl_space *space) {
   }
 }
 
+static void
+nofl_space_roll_pinned_granules(struct nofl_space *space) {
+  // With conservative intra-heap edges, nothing is ever evacuated.
+  if (gc_has_conservative_intraheap_edges())
+    return;
+  for (size_t s = 0; s < space->nslabs; s++) {
+    struct nofl_slab *slab = space->slabs[s];
+    memcpy(slab->last_pinned_granules, slab->pinned_granules,
+           sizeof(slab->pinned_granules));
+    memset(slab->pinned_granules, 0, sizeof(slab->pinned_granules));
+  }
+}
+
 static void
 nofl_space_prepare_gc(struct nofl_space *space, enum gc_collection_kind kind) {
   int is_minor = kind == GC_COLLECTION_MINOR;
+  space->aging = GC_GENERATIONAL && is_minor && space->promotion_age > 1;
   if (!is_minor) {
     nofl_space_update_mark_patterns(space, 1);
     nofl_space_clear_block_marks(space);
+    nofl_space_roll_pinned_granules(space);
+    // A major collection traces everything anyway.
+    space->rescan_block_count = 0;
   }
 }
 
@@ -1179,6 +1467,49 @@ nofl_space_start_gc(struct nofl_space *space, enum gc_collection_kind gc_kind) {
     nofl_space_prepare_evacuation(space);
 }
 
+// Bounds on the fraction of active blocks to keep as evacuation
+// targets, and the factor by which it decays after each collection that
+// doesn't compact.
+#define NOFL_EVACUATION_RESERVE_MIN 0.005
+#define NOFL_EVACUATION_RESERVE_MAX 0.1
+#define NOFL_EVACUATION_RESERVE_DECAY 0.9
+
+// The evacuation reserve guarantees that a compacting collection has
+// somewhere to put survivors, even if mutators used up all other empty
+// blocks; but its blocks are lost to allocation.  So, let it decay
+// while compaction is rare or finds enough empty blocks anyway.  If a
+// compaction runs out of targets, grow the reserve towards what it
+// managed to evacuate, without exceeding the fragmentation that it was
+// to reclaim.
+static void
+nofl_space_update_evacuation_reserve(struct nofl_space *space) {
+  size_t active = nofl_active_block_count(space);
+  if (!active)
+    return;
+  double active_granules = (double)active * NOFL_GRANULES_PER_BLOCK;
+  double reserve = space->evacuation_minimum_reserve;
+  if (space->evacuating
+      && atomic_load_explicit(&space->evacuation_truncated,
+                              memory_order_relaxed)) {
+    // The fragmentation is as measured before this compaction.
+    double evacuated = space->evacuated_granules / active_granules;
+    double fragmentation =
+      nofl_space_fragmentation(space) / NOFL_GRANULE_SIZE / active_granules;
+    double wanted = evacuated < fragmentation ? evacuated : fragmentation;
+    if (wanted > 2 * reserve)
+      wanted = 2 * reserve;
+    if (reserve < wanted)
+      reserve = wanted;
+  } else {
+    reserve *= NOFL_EVACUATION_RESERVE_DECAY;
+  }
+  if (reserve < NOFL_EVACUATION_RESERVE_MIN)
+    reserve = NOFL_EVACUATION_RESERVE_MIN;
+  if (reserve > NOFL_EVACUATION_RESERVE_MAX)
+    reserve = NOFL_EVACUATION_RESERVE_MAX;
+  space->evacuation_minimum_reserve = reserve;
+}
+
 static void
 nofl_space_finish_evacuation(struct nofl_space *space,
                              const struct gc_lock *lock) {
@@ -1197,10 +1528,92 @@ nofl_space_finish_evacuation(struct nofl_space *space,
   }
 }
 
+static void
+nofl_space_add_rescan_block(struct nofl_space *space,
+                            struct nofl_block_ref block) {
+  if (space->rescan_block_count == space->rescan_block_capacity) {
+    size_t capacity = space->rescan_block_capacity
+      ? space->rescan_block_capacity * 2 : 64;
+    space->rescan_blocks = realloc(space->rescan_blocks,
+                                   capacity * sizeof(uintptr_t));
+    if (!space->rescan_blocks)
+      GC_CRASH();
+    space->rescan_block_capacity = capacity;
+  }
+  space->rescan_blocks[space->rescan_block_count++] = block.addr;
+}
+
+// Call VISIT on the extent of each block recorded by the last minor
+// collection, then forget them.
+static void
+nofl_space_visit_rescan_blocks(struct nofl_space *space,
+                               void (*visit)(uintptr_t, uintptr_t, void*),
+                               void *visit_data) {
+  for (size_t i = 0; i < space->rescan_block_count; i++) {
+    uintptr_t addr = space->rescan_blocks[i];
+    visit(addr, addr + NOFL_BLOCK_SIZE, visit_data);
+  }
+  space->rescan_block_count = 0;
+}
+
+// The survivors of a minor collection that keeps them young have both
+// their young bit and a mark.  Make them young again by clearing the
+// mark, and clear the young bit of the young objects that weren't
+// marked, as they are dead.  Return nonzero if any object stays young.
+static int
+nofl_space_reset_young_survivors(struct nofl_space *space,
+                                 struct nofl_block_ref block) {
+  uint64_t young = broadcast_byte(NOFL_METADATA_BYTE_YOUNG);
+  uint64_t marked = broadcast_byte(space->marked_mask);
+  // Mark bits are more significant than the young bit.
+  int shift = __builtin_ctz(space->marked_mask);
+  uint8_t *metadata = nofl_metadata_byte_for_addr(block.addr);
+  uint64_t survivors = 0;
+  for (size_t i = 0; i < NOFL_GRANULES_PER_BLOCK; i += 8) {
+    uint64_t bytes;
+    memcpy(&bytes, metadata + i, 8);
+    uint64_t young_bytes = bytes & young;
+    if (!young_bytes)
+      continue;
+    uint64_t survivor_bytes = young_bytes & ((bytes & marked) >> shift);
+    bytes &= ~(young_bytes ^ survivor_bytes);
+    bytes &= ~(survivor_bytes << shift);
+    memcpy(metadata + i, &bytes, 8);
+    survivors |= survivor_bytes;
+  }
+  return survivors != 0;
+}
+
+// With a promotion age of 2, a minor collection keeps the young objects
+// that it marks young, unless they are in an aged block: one that held
+// such survivors already.  There it promotes them instead, with all the
+// other young objects in the block, which might be younger.  After the
+// collection, blocks with survivors kept young become aged, and aged
+// blocks become ordinary again.
+//
+// The objects that were just promoted might refer to objects that were
+// kept young, without those edges being in the remembered set.  So we
+// record the aged blocks, and the next minor collection traces their
+// marked objects again.
+static void
+nofl_space_age_block(struct nofl_space *space, struct nofl_block_ref block) {
+  if (!GC_GENERATIONAL)
+    return;
+  if (nofl_block_has_flag(block, NOFL_BLOCK_AGED)) {
+    nofl_block_clear_flag(block, NOFL_BLOCK_AGED);
+    if (space->aging)
+      nofl_space_add_rescan_block(space, block);
+  } else if (space->aging && nofl_space_reset_young_survivors(space, block)) {
+    nofl_block_set_flag(block, NOFL_BLOCK_AGED);
+  }
+}
+
 static void
 nofl_space_promote_blocks(struct nofl_space *space) {
   struct nofl_block_ref block;
   while (!nofl_block_is_null(block = nofl_block_list_pop(&space->promoted))) {
+    nofl_space_age_block(space, block);
+    GC_ASSERT(!nofl_block_has_flag(block, NOFL_BLOCK_AGED));
     block.summary->hole_count = 0;
     block.summary->hole_granules = 0;
     block.summary->holes_with_fragmentation = 0;
@@ -1270,10 +1683,15 @@ nofl_space_verify_swept_blocks(struct nofl_space *space,
     uintptr_t addr = b.addr;
     uintptr_t limit = addr + NOFL_BLOCK_SIZE;
     uint8_t *meta = nofl_metadata_byte_for_addr(addr);
+    // Fields of old objects may stay logged if a minor collection kept
+    // the objects they refer to young.
+    uint8_t logged_mask =
+      NOFL_METADATA_BYTE_LOGGED_0 | NOFL_METADATA_BYTE_LOGGED_1;
     while (addr < limit) {
-      if (meta[0]) {
-        GC_ASSERT(meta[0] & space->marked_mask);
-        GC_ASSERT_EQ(meta[0] & ~(space->marked_mask | NOFL_METADATA_BYTE_END), 0);
+      uint8_t byte = meta[0] & ~logged_mask;
+      if (byte) {
+        GC_ASSERT(byte & space->marked_mask);
+        GC_ASSERT_EQ(byte & ~(space->marked_mask | NOFL_METADATA_BYTE_END), 0);
         struct gc_ref obj = gc_ref(addr);
         size_t obj_bytes;
         gc_trace_object(obj, NULL, NULL, NULL, &obj_bytes);
@@ -1338,6 +1756,7 @@ nofl_space_finish_gc(struct nofl_space *space,
                      enum gc_collection_kind gc_kind) {
   space->last_collection_was_minor = (gc_kind == GC_COLLECTION_MINOR);
   struct gc_lock lock = nofl_space_lock(space);
+  nofl_space_update_evacuation_reserve(space);
   if (space->evacuating)
     nofl_space_finish_evacuation(space, &lock);
   else {
@@ -1359,9 +1778,11 @@ nofl_space_finish_gc(struct nofl_space *space,
     struct nofl_block_ref block;
     while (!nofl_block_is_null(block = nofl_block_list_pop(&space->to_sweep))) {
       if (nofl_block_is_marked(block.addr)) {
+        nofl_space_age_block(space, block);
         nofl_block_list_push(&to_sweep, block);
       } else {
         // Block is empty.
+        nofl_block_clear_flag(block, NOFL_BLOCK_AGED);
         memset(nofl_metadata_byte_for_addr(block.addr), 0,
                NOFL_GRANULES_PER_BLOCK);
         if (!nofl_push_evacuation_target_if_possible(space, block))
@@ -1379,6 +1800,7 @@ nofl_space_finish_gc(struct nofl_space *space,
   nofl_space_promote_blocks(space);
   nofl_space_reset_statistics(space);
   nofl_space_update_mark_patterns(space, 0);
+  space->aging = 0;
   if (GC_DEBUG)
     nofl_space_verify_before_restart(space);
 }
@@ -1439,11 +1861,27 @@ nofl_space_set_mark(struct nofl_space *space, uint8_t *metadata, uint8_t byte) {
   return 1;
 }
 
+static inline int
+nofl_space_should_keep_young(struct nofl_space *space, uint8_t byte,
+                             struct gc_ref ref) {
+  if (!GC_GENERATIONAL || GC_LIKELY(!space->aging))
+    return 0;
+  if (!(byte & NOFL_METADATA_BYTE_YOUNG))
+    return 0;
+  return !nofl_block_has_flag(nofl_block_for_addr(gc_ref_value(ref)),
+                              NOFL_BLOCK_AGED);
+}
+
 static inline int
 nofl_space_set_nonempty_mark(struct nofl_space *space, uint8_t *metadata,
                              uint8_t byte, struct gc_ref ref) {
   // FIXME: Check that relaxed atomics are actually worth it.
-  nofl_space_set_mark_relaxed(space, metadata, byte);
+  if (nofl_space_should_keep_young(space, byte, ref))
+    // See nofl_space_age_block.
+    atomic_store_explicit(metadata, byte | space->marked_mask,
+                          memory_order_relaxed);
+  else
+    nofl_space_set_mark_relaxed(space, metadata, byte);
   nofl_block_set_mark(gc_ref_value(ref));
   return 1;
 }
@@ -1544,6 +1982,8 @@ nofl_space_evacuate(struct nofl_space *space, uint8_t *metadata, uint8_t byte,
     } else {
       // Well shucks; allocation failed.  Mark in place and then release the
       // object.
+      atomic_store_explicit(&space->evacuation_truncated, 1,
+                            memory_order_relaxed);
       nofl_space_set_mark(space, metadata, byte);
       nofl_block_set_mark(gc_ref_value(old_ref));
       gc_atomic_forward_abort(&fwd);
@@ -1587,6 +2027,11 @@ nofl_space_evacuate_or_mark_object(struct nofl_space *space,
     return nofl_space_evacuate(space, metadata, byte, edge, old_ref,
                                evacuate);
 
+  if (!gc_has_conservative_intraheap_edges()
+      && (byte & NOFL_METADATA_BYTE_PINNED))
+    nofl_block_add_pinned_granules(gc_ref_value(old_ref),
+                                   nofl_space_live_object_granules(metadata));
+
   return nofl_space_set_nonempty_mark(space, metadata, byte, old_ref);
 }
 
@@ -1693,6 +2138,9 @@ nofl_space_mark_conservative_ref(struct nofl_space *space,
   }
 
   nofl_space_set_nonempty_mark(space, loc, byte, gc_ref(addr));
+  if (!gc_has_conservative_intraheap_edges())
+    nofl_block_add_pinned_granules(addr,
+                                   nofl_space_live_object_granules(loc));
 
   return gc_ref(addr);
 }
@@ -1704,6 +2152,42 @@ nofl_space_object_size(struct nofl_space *space, struct gc_ref ref) {
   return granules * NOFL_GRANULE_SIZE;
 }
 
+// Call VISIT on each object marked in the current cycle whose start lies
+// in [LO, HI).  Other threads may mark objects in the range
+// concurrently, in which case VISIT may or may not see them; but the
+// range must not receive evacuated objects.
+static void
+nofl_space_visit_marked_objects(struct nofl_space *space,
+                                uintptr_t lo, uintptr_t hi,
+                                void (*visit)(struct gc_ref, void*),
+                                void *visit_data) {
+  lo = align_up(lo, NOFL_GRANULE_SIZE);
+  while (lo < hi) {
+    uintptr_t block_limit = align_down(lo, NOFL_BLOCK_SIZE) + NOFL_BLOCK_SIZE;
+    uintptr_t limit = block_limit < hi ? block_limit : hi;
+    if (!nofl_space_contains_address(space, lo)
+        || nofl_block_has_flag(nofl_block_for_addr(lo),
+                               NOFL_BLOCK_UNAVAILABLE)) {
+      lo = limit;
+      continue;
+    }
+    uint8_t *meta = nofl_metadata_byte_for_addr(lo);
+    while (lo < limit) {
+      if (meta[0] & space->marked_mask) {
+        size_t granules = nofl_space_live_object_granules(meta);
+        visit(gc_ref(lo), visit_data);
+        meta += granules;
+        lo += granules * NOFL_GRANULE_SIZE;
+      } else {
+        meta++;
+        lo += NOFL_GRANULE_SIZE;
+      }
+    }
+    // An object may have run past the block limit.
+    lo = align_up(lo, NOFL_GRANULE_SIZE);
+  }
+}
+
 static struct nofl_slab*
 nofl_allocate_slabs(size_t nslabs) {
   return gc_platform_acquire_memory(nslabs * NOFL_SLAB_SIZE, NOFL_SLAB_SIZE);
@@ -1753,6 +2237,7 @@ nofl_space_shrink(struct nofl_space *space, size_t bytes) {
         nofl_block_list_pop(&space->evacuation_targets);
       GC_ASSERT(!nofl_block_is_null(block));
       nofl_push_unavailable_block(space, block, &lock);
+      avail--;
       pending = atomic_fetch_sub(&space->pending_unavailable_bytes,
                                  NOFL_BLOCK_SIZE);
       pending -= NOFL_BLOCK_SIZE;
@@ -1832,7 +2317,7 @@ nofl_space_page_out_blocks(void *data) {
 
 static int
 nofl_space_init(struct nofl_space *space, size_t size, int atomic,
-                double promotion_threshold,
+                double promotion_threshold, int promotion_age,
                 struct gc_background_thread *thread) {
   size = align_up(size, NOFL_BLOCK_SIZE);
   size_t reserved = align_up(size, NOFL_SLAB_SIZE);
@@ -1849,20 +2334,25 @@ nofl_space_init(struct nofl_space *space, size_t size, int atomic,
   space->evacuation_minimum_reserve = 0.02;
   space->evacuation_reserve = space->evacuation_minimum_reserve;
   space->promotion_threshold = promotion_threshold;
+  space->promotion_age = promotion_age;
+  // Blocks beyond the requested size start out unavailable; there are
+  // fewer than a slab's worth of them.  The rest are fresh, to be
+  // initialized on demand by nofl_pop_fresh_block.
+  size_t block_count = nslabs * NOFL_NONMETA_BLOCKS_PER_SLAB;
+  size_t unavailable_count = (reserved - size) / NOFL_BLOCK_SIZE;
+  if (unavailable_count > block_count)
+    unavailable_count = block_count;
+  space->fresh_slabs = slabs;
+  space->next_fresh_block = 0;
+  space->fresh_block_limit = block_count - unavailable_count;
   struct gc_lock lock = nofl_space_lock(space);
-  for (size_t slab = 0; slab < nslabs; slab++) {
-    for (size_t idx = 0; idx < NOFL_NONMETA_BLOCKS_PER_SLAB; idx++) {
-      uintptr_t addr = (uintptr_t)slabs[slab].blocks[idx].data;
-      struct nofl_block_ref block = nofl_block_for_addr(addr);
-      nofl_block_set_flag(block, NOFL_BLOCK_ZERO | NOFL_BLOCK_PAGED_OUT);
-      if (reserved > size) {
-        nofl_push_unavailable_block(space, block, &lock);
-        reserved -= NOFL_BLOCK_SIZE;
-      } else {
-        if (!nofl_push_evacuation_target_if_needed(space, block))
-          nofl_push_empty_block(space, block, &lock);
-      }
-    }
+  for (size_t idx = space->fresh_block_limit; idx < block_count; idx++) {
+    struct nofl_slab *slab = &slabs[idx / NOFL_NONMETA_BLOCKS_PER_SLAB];
+    uintptr_t addr =
+      (uintptr_t)slab->blocks[idx % NOFL_NONMETA_BLOCKS_PER_SLAB].data;
+    struct nofl_block_ref block = nofl_block_for_addr(addr);
+    nofl_block_set_flag(block, NOFL_BLOCK_ZERO | NOFL_BLOCK_PAGED_OUT);
+    nofl_push_unavailable_block(space, block, &lock);
   }
   gc_lock_release(&lock);
   gc_background_thread_add_task(thread, GC_BACKGROUND_TASK_START,
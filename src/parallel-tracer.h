@@ -1,17 +1,22 @@
 #ifndef PARALLEL_TRACER_H
 #define PARALLEL_TRACER_H
 
+#include <errno.h>
 #include <pthread.h>
 #include <stdatomic.h>
 #include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "assert.h"
+#include "compressed-ref.h"
 #include "debug.h"
+#include "gc-align.h"
 #include "gc-inline.h"
 #include "local-worklist.h"
 #include "root-worklist.h"
 #include "shared-worklist.h"
+#include "simple-worklist.h"
 #include "spin.h"
 #include "tracer.h"
 
@@ -40,6 +45,13 @@ struct gc_trace_worker {
   pthread_mutex_t lock;
   struct shared_worklist shared;
   struct local_worklist local;
+  // Objects that can't be represented as compressed refs, for example
+  // large objects.  Other workers steal from this list when they run
+  // out of work, so it is protected by uncompressed_lock;
+  // uncompressed_size can be read without the lock.
+  pthread_mutex_t uncompressed_lock;
+  atomic_size_t uncompressed_size;
+  struct simple_worklist uncompressed;
   struct gc_trace_worker_data *data;
 };
 
@@ -50,18 +62,99 @@ gc_trace_worker_data(struct gc_trace_worker *worker) {
 
 #define TRACE_WORKERS_MAX_COUNT 8
 
+// If the collector can rescan the heap for marked objects, we cap the
+// size of each worker's shared worklist, by default at 2^20 entries
+// (4 MB).  Objects that don't fit are recorded in an overflow bitmap,
+// one bit per 64 kB region of the compressible range, and are recovered
+// later by rescanning the marked regions.
+#define TRACE_OVERFLOW_REGION_SIZE_LOG2 16
+#define TRACE_OVERFLOW_REGION_SIZE (1 << TRACE_OVERFLOW_REGION_SIZE_LOG2)
+#define TRACE_OVERFLOW_BITS_PER_WORD (sizeof(uintptr_t) * 8)
+
+struct trace_overflow_set {
+  uintptr_t base;
+  size_t region_count;
+  size_t capacity;
+  uintptr_t *bits;
+  atomic_int overflowed;
+};
+
+// Helper worker threads are spawned lazily, when a trace starts in
+// parallel or finds work stranded on a helper's private worklists, and
+// exit after having been idle for idle_timeout_ns.  The lock protects
+// the state of each helper; a helper is either STOPPED (no thread), IDLE
+// (a thread is running or parked), or DEAD (the thread could not be
+// spawned).  helper_threads counts the IDLE helpers, so that tracers can
+// decide to wake them without taking the lock.
 struct gc_tracer {
   struct gc_heap *heap;
   atomic_size_t active_tracers;
+  atomic_size_t helper_threads;
   size_t worker_count;
   long epoch;
+  uint64_t idle_timeout_ns;
   pthread_mutex_t lock;
   pthread_cond_t cond;
   int trace_roots_only;
+  struct ref_compressor compressor;
+  unsigned shared_worklist_max_log_size;
+  unsigned rescannable_worklist_max_log_size;
+  struct trace_overflow_set overflow;
   struct root_worklist roots;
   struct gc_trace_worker workers[TRACE_WORKERS_MAX_COUNT];
 };
 
+static void
+trace_overflow_set_init(struct trace_overflow_set *set) {
+  set->base = 0;
+  set->region_count = 0;
+  set->capacity = 0;
+  set->bits = NULL;
+  atomic_init(&set->overflowed, 0);
+}
+
+static size_t
+trace_overflow_set_word_count(size_t region_count) {
+  return (region_count + TRACE_OVERFLOW_BITS_PER_WORD - 1)
+    / TRACE_OVERFLOW_BITS_PER_WORD;
+}
+
+static int
+trace_overflow_set_prepare(struct trace_overflow_set *set,
+                           struct extent_range range) {
+  GC_ASSERT(!atomic_load_explicit(&set->overflowed, memory_order_relaxed));
+  uintptr_t lo = align_down(range.lo_addr, TRACE_OVERFLOW_REGION_SIZE);
+  uintptr_t hi = align_up(range.hi_addr, TRACE_OVERFLOW_REGION_SIZE);
+  size_t region_count = (hi - lo) >> TRACE_OVERFLOW_REGION_SIZE_LOG2;
+  if (region_count > set->capacity) {
+    size_t bytes = trace_overflow_set_word_count(region_count)
+      * sizeof(uintptr_t);
+    bytes = align_up(bytes, gc_platform_page_size());
+    uintptr_t *bits = gc_platform_acquire_memory(bytes, 0);
+    if (!bits)
+      return 0;
+    if (set->bits)
+      gc_platform_release_memory(set->bits, set->capacity / 8);
+    set->bits = bits;
+    set->capacity = bytes * 8;
+  }
+  set->base = lo;
+  set->region_count = region_count;
+  return 1;
+}
+
+static void
+trace_overflow_set_add(struct trace_overflow_set *set, struct gc_ref ref) {
+  size_t region =
+    (gc_ref_value(ref) - set->base) >> TRACE_OVERFLOW_REGION_SIZE_LOG2;
+  GC_ASSERT(region < set->region_count);
+  uintptr_t *loc = &set->bits[region / TRACE_OVERFLOW_BITS_PER_WORD];
+  uintptr_t bit = ((uintptr_t)1) << (region % TRACE_OVERFLOW_BITS_PER_WORD);
+  if (!(atomic_load_explicit(loc, memory_order_relaxed) & bit))
+    atomic_fetch_or_explicit(loc, bit, memory_order_relaxed);
+  atomic_store_explicit(&set->overflowed, 1, memory_order_relaxed);
+}
+
 static int
 trace_worker_init(struct gc_trace_worker *worker, struct gc_heap *heap,
                   struct gc_tracer *tracer, size_t id) {
@@ -72,50 +165,105 @@ trace_worker_init(struct gc_trace_worker *worker, struct gc_heap *heap,
   worker->thread = 0;
   worker->state = TRACE_WORKER_STOPPED;
   pthread_mutex_init(&worker->lock, NULL);
+  pthread_mutex_init(&worker->uncompressed_lock, NULL);
+  atomic_init(&worker->uncompressed_size, 0);
   worker->data = NULL;
   local_worklist_init(&worker->local);
-  return shared_worklist_init(&worker->shared);
+  return shared_worklist_init(&worker->shared)
+    && simple_worklist_init(&worker->uncompressed);
 }
 
 static void trace_worker_trace(struct gc_trace_worker *worker);
 
+static struct timespec
+trace_worker_idle_deadline(struct gc_tracer *tracer) {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+    perror("clock_gettime failed");
+    GC_CRASH();
+  }
+  uint64_t ns = ts.tv_nsec + tracer->idle_timeout_ns;
+  ts.tv_sec += ns / 1000000000;
+  ts.tv_nsec = ns % 1000000000;
+  return ts;
+}
+
+// Helper workers wait for a new epoch on the tracer lock, and only take
+// their own lock while tracing.  The main worker holds the helper locks
+// between traces, so a helper that wakes up late will block until the
+// next trace starts.
 static void*
 trace_worker_thread(void *data) {
   struct gc_trace_worker *worker = data;
   struct gc_tracer *tracer = worker->tracer;
   long trace_epoch = 0;
 
-  pthread_mutex_lock(&worker->lock);
+  pthread_mutex_lock(&tracer->lock);
+  struct timespec deadline = trace_worker_idle_deadline(tracer);
   while (1) {
     long epoch = atomic_load_explicit(&tracer->epoch, memory_order_acquire);
     if (trace_epoch != epoch) {
       trace_epoch = epoch;
+      pthread_mutex_unlock(&tracer->lock);
+      pthread_mutex_lock(&worker->lock);
       trace_worker_trace(worker);
+      pthread_mutex_unlock(&worker->lock);
+      pthread_mutex_lock(&tracer->lock);
+      deadline = trace_worker_idle_deadline(tracer);
+      continue;
     }
-    pthread_cond_wait(&tracer->cond, &worker->lock);
+    if (pthread_cond_timedwait(&tracer->cond, &tracer->lock,
+                               &deadline) == ETIMEDOUT
+        && trace_epoch == atomic_load_explicit(&tracer->epoch,
+                                               memory_order_acquire))
+      break;
   }
+  DEBUG("tracer #%zu: idle, exiting\n", worker->id);
+  worker->state = TRACE_WORKER_STOPPED;
+  atomic_fetch_sub_explicit(&tracer->helper_threads, 1, memory_order_relaxed);
+  pthread_mutex_unlock(&tracer->lock);
   return NULL;
 }
 
-static int
+// Call with the tracer lock held.
+static void
 trace_worker_spawn(struct gc_trace_worker *worker) {
+  GC_ASSERT_EQ(worker->state, TRACE_WORKER_STOPPED);
   if (pthread_create(&worker->thread, NULL, trace_worker_thread, worker)) {
     perror("spawning tracer thread failed");
-    return 0;
+    worker->state = TRACE_WORKER_DEAD;
+    return;
   }
-
-  return 1;
+  pthread_detach(worker->thread);
+  worker->state = TRACE_WORKER_IDLE;
+  atomic_fetch_add_explicit(&worker->tracer->helper_threads, 1,
+                            memory_order_relaxed);
 }
 
 static int
 gc_tracer_init(struct gc_tracer *tracer, struct gc_heap *heap,
-               size_t parallelism) {
+               size_t parallelism, double idle_timeout,
+               unsigned worklist_max_log_size) {
   tracer->heap = heap;
   atomic_init(&tracer->active_tracers, 0);
+  atomic_init(&tracer->helper_threads, 0);
   tracer->epoch = 0;
+  tracer->idle_timeout_ns = idle_timeout * 1e9;
   tracer->trace_roots_only = 0;
+  ref_compressor_reset(&tracer->compressor);
+  tracer->shared_worklist_max_log_size = shared_worklist_buf_max_log_size;
+  if (worklist_max_log_size < shared_worklist_buf_min_log_size)
+    worklist_max_log_size = shared_worklist_buf_min_log_size;
+  if (worklist_max_log_size > shared_worklist_buf_max_log_size)
+    worklist_max_log_size = shared_worklist_buf_max_log_size;
+  tracer->rescannable_worklist_max_log_size = worklist_max_log_size;
+  trace_overflow_set_init(&tracer->overflow);
   pthread_mutex_init(&tracer->lock, NULL);
-  pthread_cond_init(&tracer->cond, NULL);
+  pthread_condattr_t cond_attr;
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&tracer->cond, &cond_attr);
+  pthread_condattr_destroy(&cond_attr);
   root_worklist_init(&tracer->roots);
   size_t desired_worker_count = parallelism;
   ASSERT(desired_worker_count);
@@ -124,14 +272,13 @@ gc_tracer_init(struct gc_tracer *tracer, struct gc_heap *heap,
   if (!trace_worker_init(&tracer->workers[0], heap, tracer, 0))
     return 0;
   tracer->worker_count++;
+  // Threads for the helpers are spawned on demand; see
+  // tracer_start_all_workers.
   for (size_t i = 1; i < desired_worker_count; i++) {
     if (!trace_worker_init(&tracer->workers[i], heap, tracer, i))
       break;
     pthread_mutex_lock(&tracer->workers[i].lock);
-    if (trace_worker_spawn(&tracer->workers[i]))
-      tracer->worker_count++;
-    else
-      break;
+    tracer->worker_count++;
   }
   return 1;
 }
@@ -139,10 +286,23 @@ gc_tracer_init(struct gc_tracer *tracer, struct gc_heap *heap,
 static void gc_tracer_prepare(struct gc_tracer *tracer) {
   for (size_t i = 0; i < tracer->worker_count; i++)
     tracer->workers[i].steal_id = (i + 1) % tracer->worker_count;
+  struct extent_range range = gc_trace_compressible_range(tracer->heap);
+  ref_compressor_init(&tracer->compressor, range,
+                      gc_allocator_small_granule_size());
+  // Only compressed refs go to shared worklists, so the overflow set
+  // needs to cover just the compressible range.
+  if (gc_trace_can_rescan(tracer->heap)
+      && trace_overflow_set_prepare(&tracer->overflow, range))
+    tracer->shared_worklist_max_log_size =
+      tracer->rescannable_worklist_max_log_size;
+  else
+    tracer->shared_worklist_max_log_size = shared_worklist_buf_max_log_size;
 }
 static void gc_tracer_release(struct gc_tracer *tracer) {
-  for (size_t i = 0; i < tracer->worker_count; i++)
+  for (size_t i = 0; i < tracer->worker_count; i++) {
     shared_worklist_release(&tracer->workers[i].shared);
+    simple_worklist_release(&tracer->workers[i].uncompressed);
+  }
 }
 
 static inline void
@@ -150,6 +310,11 @@ gc_tracer_add_root(struct gc_tracer *tracer, struct gc_root root) {
   root_worklist_push(&tracer->roots, root);
 }
 
+static inline size_t
+gc_tracer_worker_count(struct gc_tracer *tracer) {
+  return tracer->worker_count;
+}
+
 static inline void
 tracer_unpark_all_workers(struct gc_tracer *tracer) {
   long old_epoch =
@@ -160,45 +325,125 @@ tracer_unpark_all_workers(struct gc_tracer *tracer) {
   pthread_cond_broadcast(&tracer->cond);
 }
 
+// Spawn threads for helpers that don't have one, and wake all helpers.
+// Unlike tracer_unpark_all_workers, this takes the tracer lock, so it is
+// only for the start of a trace and for the rare stranded-work case.
+static void
+tracer_start_all_workers(struct gc_tracer *tracer) {
+  pthread_mutex_lock(&tracer->lock);
+  for (size_t i = 1; i < tracer->worker_count; i++)
+    if (tracer->workers[i].state == TRACE_WORKER_STOPPED)
+      trace_worker_spawn(&tracer->workers[i]);
+  tracer_unpark_all_workers(tracer);
+  pthread_mutex_unlock(&tracer->lock);
+}
+
+// Called from the tracing fast path: wake parked helpers, if there are
+// any, without taking the tracer lock.  A helper that is just about to
+// park may miss the wakeup; it will notice the new epoch at its idle
+// deadline.
 static inline void
 tracer_maybe_unpark_workers(struct gc_tracer *tracer) {
   size_t active =
     atomic_load_explicit(&tracer->active_tracers, memory_order_acquire);
-  if (active < tracer->worker_count)
+  size_t helpers =
+    atomic_load_explicit(&tracer->helper_threads, memory_order_relaxed);
+  if (active <= helpers)
     tracer_unpark_all_workers(tracer);
 }
 
+static void
+tracer_overflow(struct gc_tracer *tracer, struct compressed_ref *objv,
+                size_t count) GC_NEVER_INLINE;
+static void
+tracer_overflow(struct gc_tracer *tracer, struct compressed_ref *objv,
+                size_t count) {
+  DEBUG("tracer: worklist overflow, %zu objects to rescan\n", count);
+  for (size_t i = 0; i < count; i++)
+    trace_overflow_set_add(&tracer->overflow,
+                           ref_compressor_decompress(&tracer->compressor,
+                                                     objv[i]));
+}
+
 static inline void
 tracer_share(struct gc_trace_worker *worker) {
   DEBUG("tracer #%zu: sharing\n", worker->id);
+  struct gc_tracer *tracer = worker->tracer;
   size_t to_share = LOCAL_WORKLIST_SHARE_AMOUNT;
   while (to_share) {
-    struct gc_ref *objv;
+    struct compressed_ref *objv;
     size_t count = local_worklist_pop_many(&worker->local, &objv, to_share);
-    shared_worklist_push_many(&worker->shared, objv, count);
+    size_t pushed =
+      shared_worklist_push_many(&worker->shared, objv, count,
+                                tracer->shared_worklist_max_log_size);
+    if (GC_UNLIKELY(pushed < count))
+      tracer_overflow(tracer, objv + pushed, count - pushed);
     to_share -= count;
   }
-  tracer_maybe_unpark_workers(worker->tracer);
+  tracer_maybe_unpark_workers(tracer);
+}
+
+static void
+trace_worker_push_uncompressed(struct gc_trace_worker *worker,
+                               struct gc_ref ref) GC_NEVER_INLINE;
+static void
+trace_worker_push_uncompressed(struct gc_trace_worker *worker,
+                               struct gc_ref ref) {
+  pthread_mutex_lock(&worker->uncompressed_lock);
+  simple_worklist_push(&worker->uncompressed, ref);
+  size_t size = atomic_load_explicit(&worker->uncompressed_size,
+                                     memory_order_relaxed) + 1;
+  atomic_store_explicit(&worker->uncompressed_size, size,
+                        memory_order_release);
+  pthread_mutex_unlock(&worker->uncompressed_lock);
+  // If there is more than we are about to trace, let others help.
+  if (size > 1)
+    tracer_maybe_unpark_workers(worker->tracer);
+}
+
+static struct gc_ref
+trace_worker_pop_uncompressed(struct gc_trace_worker *worker) {
+  if (!atomic_load_explicit(&worker->uncompressed_size, memory_order_acquire))
+    return gc_ref_null();
+  pthread_mutex_lock(&worker->uncompressed_lock);
+  struct gc_ref ref = simple_worklist_pop(&worker->uncompressed);
+  if (!gc_ref_is_null(ref))
+    atomic_fetch_sub_explicit(&worker->uncompressed_size, 1,
+                              memory_order_relaxed);
+  pthread_mutex_unlock(&worker->uncompressed_lock);
+  return ref;
 }
 
 static inline void
 gc_trace_worker_enqueue(struct gc_trace_worker *worker, struct gc_ref ref) {
   ASSERT(gc_ref_is_heap_object(ref));
+  const struct ref_compressor *compressor = &worker->tracer->compressor;
+  if (GC_UNLIKELY(!ref_compressor_can_compress(compressor, ref))) {
+    trace_worker_push_uncompressed(worker, ref);
+    return;
+  }
   if (local_worklist_full(&worker->local))
     tracer_share(worker);
-  local_worklist_push(&worker->local, ref);
+  local_worklist_push(&worker->local,
+                      ref_compressor_compress(compressor, ref));
 }
 
 static struct gc_ref
 tracer_steal_from_worker(struct gc_tracer *tracer, size_t id) {
   ASSERT(id < tracer->worker_count);
-  return shared_worklist_steal(&tracer->workers[id].shared);
+  struct gc_trace_worker *victim = &tracer->workers[id];
+  struct compressed_ref ref = shared_worklist_steal(&victim->shared);
+  if (!compressed_ref_is_null(ref))
+    return ref_compressor_decompress(&tracer->compressor, ref);
+  return trace_worker_pop_uncompressed(victim);
 }
 
 static int
 tracer_can_steal_from_worker(struct gc_tracer *tracer, size_t id) {
   ASSERT(id < tracer->worker_count);
-  return shared_worklist_can_steal(&tracer->workers[id].shared);
+  struct gc_trace_worker *victim = &tracer->workers[id];
+  return shared_worklist_can_steal(&victim->shared)
+    || atomic_load_explicit(&victim->uncompressed_size, memory_order_acquire);
 }
 
 static struct gc_ref
@@ -235,6 +480,21 @@ trace_worker_can_steal_from_any(struct gc_trace_worker *worker,
   return 0;
 }
 
+// Objects enqueued by a helper during a roots-only trace stay on its
+// private worklists until the helper runs again.  Call with all helpers
+// locked.
+static int
+tracer_has_stranded_work(struct gc_tracer *tracer) {
+  for (size_t i = 1; i < tracer->worker_count; i++) {
+    struct gc_trace_worker *worker = &tracer->workers[i];
+    if (!local_worklist_empty(&worker->local)
+        || atomic_load_explicit(&worker->uncompressed_size,
+                                memory_order_acquire))
+      return 1;
+  }
+  return 0;
+}
+
 static int
 trace_worker_should_continue(struct gc_trace_worker *worker) {
   // Helper workers should park themselves immediately if they have no work.
@@ -259,10 +519,15 @@ trace_worker_should_continue(struct gc_trace_worker *worker) {
       }
       int done = (locked == tracer->worker_count) &&
         !trace_worker_can_steal_from_any(worker, tracer);
-      if (done)
+      int stranded = done && tracer_has_stranded_work(tracer);
+      if (done && !stranded)
         return 0;
       while (locked > 1)
         pthread_mutex_unlock(&tracer->workers[--locked].lock);
+      // Helpers that missed this trace's wakeup, or whose threads have
+      // since exited, need to run to drain their private worklists.
+      if (stranded)
+        tracer_start_all_workers(tracer);
       return 1;
     }
     // spin
@@ -271,6 +536,46 @@ trace_worker_should_continue(struct gc_trace_worker *worker) {
   }
 }
 
+// Called by the main worker when the trace appears to be done, with all
+// other workers parked.  If any object overflowed the worklists, trace
+// all marked objects in regions that had overflow, and return 1 to
+// indicate that the trace should continue.  Rescanning is done while
+// the other workers are parked, so that the collector doesn't see
+// objects that are in the process of being marked or evacuated, but
+// any work generated by the rescan is shared as usual.
+static int
+trace_worker_recover_overflow(struct gc_trace_worker *worker) {
+  if (worker->id != 0)
+    return 0;
+
+  struct gc_tracer *tracer = worker->tracer;
+  struct trace_overflow_set *set = &tracer->overflow;
+  if (!atomic_load_explicit(&set->overflowed, memory_order_acquire))
+    return 0;
+
+  DEBUG("tracer #%zu: recovering from worklist overflow\n", worker->id);
+  atomic_store_explicit(&set->overflowed, 0, memory_order_relaxed);
+  size_t words = trace_overflow_set_word_count(set->region_count);
+  for (size_t i = 0; i < words; i++) {
+    uintptr_t bits = atomic_exchange_explicit(&set->bits[i], 0,
+                                              memory_order_relaxed);
+    while (bits) {
+      size_t bit = __builtin_ctzll(bits);
+      bits &= bits - 1;
+      size_t region = i * TRACE_OVERFLOW_BITS_PER_WORD + bit;
+      uintptr_t lo = set->base + (region << TRACE_OVERFLOW_REGION_SIZE_LOG2);
+      gc_trace_rescan_range(tracer->heap, worker, lo,
+                            lo + TRACE_OVERFLOW_REGION_SIZE);
+    }
+  }
+
+  // trace_worker_should_continue left the other workers locked; let them
+  // help with the work that the rescan generated.
+  for (size_t i = 1; i < tracer->worker_count; i++)
+    pthread_mutex_unlock(&tracer->workers[i].lock);
+  return 1;
+}
+
 static struct gc_ref
 trace_worker_steal(struct gc_trace_worker *worker) {
   struct gc_tracer *tracer = worker->tracer;
@@ -280,7 +585,9 @@ trace_worker_steal(struct gc_trace_worker *worker) {
   // something from the worker's own queue.
   {
     LOG("tracer #%zu: trying to pop worker's own deque\n", worker->id);
-    struct gc_ref obj = shared_worklist_try_pop(&worker->shared);
+    struct gc_ref obj =
+      ref_compressor_decompress(&tracer->compressor,
+                                shared_worklist_try_pop(&worker->shared));
     if (!gc_ref_is_null(obj))
       return obj;
   }
@@ -334,16 +641,21 @@ trace_with_data(struct gc_tracer *tracer,
       while (1) {
         struct gc_ref ref;
         if (!local_worklist_empty(&worker->local)) {
-          ref = local_worklist_pop(&worker->local);
+          ref = ref_compressor_decompress(&tracer->compressor,
+                                          local_worklist_pop(&worker->local));
         } else {
-          ref = trace_worker_steal(worker);
-          if (gc_ref_is_null(ref))
-            break;
+          ref = trace_worker_pop_uncompressed(worker);
+          if (gc_ref_is_null(ref)) {
+            ref = trace_worker_steal(worker);
+            if (gc_ref_is_null(ref))
+              break;
+          }
         }
         trace_one(ref, heap, worker);
         n++;
       }
-    } while (trace_worker_should_continue(worker));
+    } while (trace_worker_should_continue(worker)
+             || trace_worker_recover_overflow(worker));
 
     DEBUG("tracer #%zu: done tracing, %zu objects traced\n", worker->id, n);
   }
@@ -370,7 +682,9 @@ gc_tracer_should_parallelize(struct gc_tracer *tracer) {
   ssize_t parallel_threshold =
     LOCAL_WORKLIST_SIZE - LOCAL_WORKLIST_SHARE_AMOUNT;
   for (size_t i = 0; i < tracer->worker_count; i++) {
-    ssize_t size = shared_worklist_size(&tracer->workers[i].shared);
+    ssize_t size = shared_worklist_size(&tracer->workers[i].shared)
+      + atomic_load_explicit(&tracer->workers[i].uncompressed_size,
+                             memory_order_relaxed);
     if (!size)
       continue;
     nonempty_worklists++;
@@ -391,7 +705,7 @@ gc_tracer_trace(struct gc_tracer *tracer) {
 
   if (gc_tracer_should_parallelize(tracer)) {
     DEBUG("waking workers\n");
-    tracer_unpark_all_workers(tracer);
+    tracer_start_all_workers(tracer);
   } else {
     DEBUG("starting in local-only mode\n");
   }
@@ -1,8 +1,10 @@
+#include <errno.h>
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include "gc-api.h"
 
@@ -10,6 +12,7 @@
 #include "gc-internal.h"
 
 #include "background-thread.h"
+#include "compressed-ref.h"
 #include "copy-space.h"
 #include "debug.h"
 #include "field-set.h"
@@ -75,9 +78,11 @@ struct gc_heap {
 };
 
 #define HEAP_EVENT(heap, event, ...)                                    \
-  (heap)->event_listener.event((heap)->event_listener_data, ##__VA_ARGS__)
-#define MUTATOR_EVENT(mut, event, ...)                                  \
-  (mut)->heap->event_listener.event((mut)->event_listener_data, ##__VA_ARGS__)
+  GC_HEAP_EVENT((heap)->event_listener, (heap)->event_listener_data,    \
+                event, ##__VA_ARGS__)
+#define MUTATOR_EVENT(mut, event)                                       \
+  GC_MUTATOR_EVENT((mut)->heap->event_listener, (mut),                  \
+                   (mut)->event_listener_data, event)
 
 struct gc_mutator {
   struct copy_space_allocator allocator;
@@ -89,6 +94,10 @@ struct gc_mutator {
   void *event_listener_data;
   struct gc_mutator *next;
   struct gc_mutator *prev;
+  uint64_t allocated_bytes;
+  uint64_t allocation_quota_base;
+  uint64_t allocation_quota;
+  uintptr_t allocation_mark;
 };
 
 struct gc_trace_worker_data {
@@ -247,13 +256,42 @@ gc_trace_worker_call_with_data(void (*f)(struct gc_tracer *tracer,
                                 heap_new_space(heap));
     copy_space_allocator_finish(trace_worker_old_space_allocator(&data),
                                 heap_old_space(heap));
-    gc_field_set_writer_release_buffer(trace_worker_field_logger(&data));
+    gc_field_set_writer_finish(trace_worker_field_logger(&data));
   } else {
     copy_space_allocator_finish(trace_worker_mono_space_allocator(&data),
                                 heap_mono_space(heap));
   }
 }
 
+static inline struct extent_range
+gc_trace_compressible_range(struct gc_heap *heap) {
+  if (!GC_GENERATIONAL)
+    return copy_space_bounds(heap_mono_space(heap));
+  // The two spaces are separate mappings.  If they are too far apart
+  // for one window, cover the old space, as that is where the traced
+  // objects are copied to.
+  struct extent_range old = copy_space_bounds(heap_old_space(heap));
+  struct extent_range both =
+    extent_range_union(copy_space_bounds(heap_new_space(heap)), old);
+  if (both.hi_addr - both.lo_addr
+      < ref_compressor_max_span(gc_allocator_small_granule_size()))
+    return both;
+  return old;
+}
+
+static inline int
+gc_trace_can_rescan(struct gc_heap *heap) {
+  // Copy spaces have no mark bits, so there's no way to find objects
+  // that overflowed the worklists.
+  return 0;
+}
+
+static void
+gc_trace_rescan_range(struct gc_heap *heap, struct gc_trace_worker *worker,
+                      uintptr_t lo, uintptr_t hi) {
+  GC_CRASH();
+}
+
 static int new_space_contains_addr(struct gc_heap *heap, uintptr_t addr) {
   return copy_space_contains_address_aligned(heap_new_space(heap), addr);
 }
@@ -480,10 +518,31 @@ static void maybe_increase_max_active_mutator_count(struct gc_heap *heap) {
     heap->max_active_mutator_count = active_mutators;
 }
 
+// Bytes that a mutator bump-allocates inline are not counted as they
+// are allocated; instead the mutator remembers where its uncounted
+// allocations start, and tallies them up when it next leaves its
+// current block.
+static void mutator_count_allocation(struct gc_mutator *mut) {
+  if (mut->allocation_mark) {
+    mut->allocated_bytes += mut->allocator.hp - mut->allocation_mark;
+    mut->allocation_mark = 0;
+  }
+}
+
+static int mutator_exceeded_allocation_quota(struct gc_mutator *mut) {
+  return mut->allocation_quota
+    && (mut->allocated_bytes - mut->allocation_quota_base
+        > mut->allocation_quota);
+}
+
+static void reset_mutator_allocation_quotas(struct gc_heap *heap) {
+  for (struct gc_mutator *mut = heap->mutators; mut; mut = mut->next)
+    mut->allocation_quota_base = mut->allocated_bytes;
+}
+
 static void add_mutator(struct gc_heap *heap, struct gc_mutator *mut) {
   mut->heap = heap;
-  mut->event_listener_data =
-    heap->event_listener.mutator_added(heap->event_listener_data);
+  mut->event_listener_data = HEAP_EVENT(heap, mutator_added);
   copy_space_allocator_init(&mut->allocator);
   if (GC_GENERATIONAL)
     gc_field_set_writer_init(mutator_field_logger(mut),
@@ -506,9 +565,10 @@ static void add_mutator(struct gc_heap *heap, struct gc_mutator *mut) {
 }
 
 static void remove_mutator(struct gc_heap *heap, struct gc_mutator *mut) {
+  mutator_count_allocation(mut);
   copy_space_allocator_finish(&mut->allocator, heap_allocation_space(heap));
   if (GC_GENERATIONAL)
-    gc_field_set_writer_release_buffer(mutator_field_logger(mut));
+    gc_field_set_writer_finish(mutator_field_logger(mut));
   MUTATOR_EVENT(mut, mutator_removed);
   mut->heap = NULL;
   heap_lock(heap);
@@ -607,6 +667,10 @@ static inline void trace_root(struct gc_root root, struct gc_heap *heap,
     gc_field_set_visit_edge_buffer(heap_remembered_set(heap), root.edge_buffer,
                                    trace_remembered_edge, heap, worker);
     break;
+  case GC_ROOT_KIND_EPHEMERON_SWEEP:
+    gc_sweep_pending_ephemerons(gc_heap_pending_ephemerons(heap),
+                                root.shard.index, root.shard.count);
+    break;
   default:
     GC_CRASH();
   }
@@ -796,8 +860,13 @@ static void resolve_finalizers(struct gc_heap *heap) {
   gc_notify_finalizers(heap->finalizer_state, heap);
 }
 
+// The pending ephemeron table is sized in proportion to the heap, so
+// sweep it with all trace workers.
 static void sweep_ephemerons(struct gc_heap *heap) {
-  return gc_sweep_pending_ephemerons(gc_heap_pending_ephemerons(heap), 0, 1);
+  size_t nshards = gc_tracer_worker_count(&heap->tracer);
+  for (size_t shard = 0; shard < nshards; shard++)
+    gc_tracer_add_root(&heap->tracer, gc_root_ephemeron_sweep(shard, nshards));
+  gc_tracer_trace_roots(&heap->tracer);
 }
 
 static int
@@ -922,6 +991,7 @@ collect(struct gc_mutator *mut, enum gc_collection_kind requested_kind) {
       GC_CRASH();
     }
   }
+  reset_mutator_allocation_quotas(heap);
   HEAP_EVENT(heap, restarting_mutators);
   allow_mutators_to_continue(heap);
   return gc_kind;
@@ -930,6 +1000,7 @@ collect(struct gc_mutator *mut, enum gc_collection_kind requested_kind) {
 static void trigger_collection(struct gc_mutator *mut,
                                enum gc_collection_kind requested_kind) {
   struct gc_heap *heap = mutator_heap(mut);
+  mutator_count_allocation(mut);
   copy_space_allocator_finish(&mut->allocator, heap_allocation_space(heap));
   if (GC_GENERATIONAL)
     gc_field_set_writer_release_buffer(mutator_field_logger(mut));
@@ -974,11 +1045,74 @@ static void get_more_empty_blocks_for_mutator(void *mut) {
   trigger_collection(mut, GC_COLLECTION_MINOR);
 }
 
+// How long a mutator over its allocation quota waits for the next
+// collection, at most, before allocating again.
+#define MUTATOR_THROTTLE_TIMEOUT_NS (1000 * 1000)
+
+// Park a mutator that is over its allocation quota until the next
+// collection, or for MUTATOR_THROTTLE_TIMEOUT_NS, whichever comes
+// first, so that the other mutators can get ahead.  The mutator is
+// inactive while it waits, so a collection needn't wait for it.  A
+// mutator that is the only active one doesn't wait, as it would just
+// delay the collection that resets its quota.  Either way the mutator
+// starts a new quota period, so it waits at most once per quota of
+// allocation, allocating about one quota per millisecond while others
+// run.
+static void throttle_mutator(struct gc_mutator *mut) GC_NEVER_INLINE;
+static void throttle_mutator(struct gc_mutator *mut) {
+  struct gc_heap *heap = mutator_heap(mut);
+  mut->allocation_quota_base = mut->allocated_bytes;
+  // Racy, but a stale count only means waiting once more or less.
+  size_t active =
+    atomic_load_explicit(&heap->mutator_count, memory_order_relaxed)
+    - atomic_load_explicit(&heap->inactive_mutator_count,
+                           memory_order_relaxed);
+  if (active <= 1)
+    return;
+
+  struct timespec deadline;
+  if (clock_gettime(CLOCK_MONOTONIC, &deadline)) {
+    perror("clock_gettime failed");
+    GC_CRASH();
+  }
+  deadline.tv_nsec += MUTATOR_THROTTLE_TIMEOUT_NS;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  mutator_count_allocation(mut);
+  copy_space_allocator_finish(&mut->allocator, heap_allocation_space(heap));
+  if (GC_GENERATIONAL)
+    gc_field_set_writer_release_buffer(mutator_field_logger(mut));
+  heap_lock(heap);
+  long count = heap->count;
+  heap->inactive_mutator_count++;
+  if (all_mutators_stopped(heap))
+    pthread_cond_signal(&heap->collector_cond);
+  while (heap->count == count && !mutators_are_stopping(heap))
+    if (pthread_cond_timedwait(&heap->mutator_cond, &heap->lock,
+                               &deadline) == ETIMEDOUT)
+      break;
+  while (mutators_are_stopping(heap))
+    pthread_cond_wait(&heap->mutator_cond, &heap->lock);
+  heap->inactive_mutator_count--;
+  maybe_increase_max_active_mutator_count(heap);
+  heap_unlock(heap);
+}
+
 void* gc_allocate_slow(struct gc_mutator *mut, size_t size) {
   GC_ASSERT(size > 0); // allocating 0 bytes would be silly
+  GC_PROBE(allocate_slow, mut, size);
+
+  mutator_count_allocation(mut);
+  if (mutator_exceeded_allocation_quota(mut))
+    throttle_mutator(mut);
 
-  if (size > gc_allocator_large_threshold())
+  if (size > gc_allocator_large_threshold()) {
+    mut->allocated_bytes += size;
     return allocate_large(mut, size);
+  }
 
   struct gc_ref ret;
   while (1) {
@@ -991,10 +1125,22 @@ void* gc_allocate_slow(struct gc_mutator *mut, size_t size) {
       break;
   }
 
+  mut->allocation_mark = gc_ref_value(ret);
   gc_clear_fresh_allocation(ret, size);
   return gc_ref_heap_object(ret);
 }
 
+uint64_t gc_mutator_allocated_bytes(struct gc_mutator *mut) {
+  uint64_t ret = mut->allocated_bytes;
+  if (mut->allocation_mark)
+    ret += mut->allocator.hp - mut->allocation_mark;
+  return ret;
+}
+
+void gc_mutator_set_allocation_quota(struct gc_mutator *mut, uint64_t bytes) {
+  mut->allocation_quota = bytes;
+}
+
 void* gc_allocate_pointerless(struct gc_mutator *mut, size_t size) {
   return gc_allocate(mut, size);
 }
@@ -1043,6 +1189,8 @@ int* gc_safepoint_flag_loc(struct gc_mutator *mut) {
 
 void gc_safepoint_slow(struct gc_mutator *mut) {
   struct gc_heap *heap = mutator_heap(mut);
+  GC_PROBE(safepoint, mut);
+  mutator_count_allocation(mut);
   copy_space_allocator_finish(&mut->allocator, heap_allocation_space(heap));
   if (GC_GENERATIONAL)
     gc_field_set_writer_release_buffer(mutator_field_logger(mut));
@@ -1165,7 +1313,12 @@ static int heap_init(struct gc_heap *heap, const struct gc_options *options) {
   if (GC_GENERATIONAL)
     gc_field_set_init(heap_remembered_set(heap));
   pthread_mutex_init(&heap->lock, NULL);
-  pthread_cond_init(&heap->mutator_cond, NULL);
+  // Throttled mutators wait on mutator_cond with a monotonic deadline.
+  pthread_condattr_t cond_attr;
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&heap->mutator_cond, &cond_attr);
+  pthread_condattr_destroy(&cond_attr);
   pthread_cond_init(&heap->collector_cond, NULL);
   heap->size = options->common.heap_size;
   heap->processor_count = gc_platform_processor_count();
@@ -1177,7 +1330,9 @@ static int heap_init(struct gc_heap *heap, const struct gc_options *options) {
   heap->per_processor_nursery_size = 2 * 1024 * 1024;
 #endif
 
-  if (!gc_tracer_init(&heap->tracer, heap, options->common.parallelism))
+  if (!gc_tracer_init(&heap->tracer, heap, options->common.parallelism,
+                      options->common.trace_worker_idle_timeout,
+                      options->common.trace_worklist_max_log_size))
     GC_CRASH();
 
   heap->pending_ephemerons_size_factor = 0.005;
@@ -1291,6 +1446,7 @@ void gc_finish_for_thread(struct gc_mutator *mut) {
 
 static void deactivate_mutator(struct gc_heap *heap, struct gc_mutator *mut) {
   GC_ASSERT(mut->next == NULL);
+  mutator_count_allocation(mut);
   copy_space_allocator_finish(&mut->allocator, heap_allocation_space(heap));
   if (GC_GENERATIONAL)
     gc_field_set_writer_release_buffer(mutator_field_logger(mut));
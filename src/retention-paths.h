@@ -0,0 +1,248 @@
+#ifndef RETENTION_PATHS_H
+#define RETENTION_PATHS_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "address-map.h"
+#include "gc-embedder-api.h"
+#include "gc-ref.h"
+#include "root.h"
+
+// Diagnostics to find out what keeps the heap alive.  During a
+// collection that records retention paths, each object that the
+// collector marks for the first time is entered in a map, along with
+// the object that referenced it, or with the kind of root that
+// referenced it.  As each object is entered only once, the recorded
+// parents form a spanning tree of the live heap.  After tracing, we
+// sample the live objects, walk each sampled object's parents back to
+// its root, and summarize the paths by the kinds of the objects along
+// them, as named by the embedder's gc_object_kind_name.
+//
+// Recording takes a lock per marked object and memory proportional to
+// the number of live objects, so it is only for occasional diagnostic
+// collections.
+
+#define RETENTION_PATHS_SAMPLE_COUNT 1000
+#define RETENTION_PATHS_MAX_DEPTH 4096
+#define RETENTION_PATHS_MAX_KINDS 16
+#define RETENTION_PATHS_PRINT_KINDS 8
+#define RETENTION_PATHS_PRINT_PATHS_PER_KIND 4
+
+struct retention_paths {
+  pthread_mutex_t lock;
+  struct address_map parents;
+  int recording;
+};
+
+// A parent is either an object address or, for objects referenced
+// directly by a root, the root kind.  Root kinds are small integers and
+// can't be confused with addresses.
+static inline uintptr_t
+retention_parent_for_object(struct gc_ref ref) {
+  return gc_ref_value(ref);
+}
+static inline uintptr_t
+retention_parent_for_root(enum gc_root_kind kind) {
+  return kind;
+}
+static inline int
+retention_parent_is_root(uintptr_t parent) {
+  return parent <= GC_ROOT_KIND_MARKED_OBJECTS;
+}
+
+static void
+retention_paths_init(struct retention_paths *paths) {
+  pthread_mutex_init(&paths->lock, NULL);
+  address_map_init(&paths->parents);
+  paths->recording = 0;
+}
+
+static void
+retention_paths_start(struct retention_paths *paths) {
+  address_map_clear(&paths->parents);
+  paths->recording = 1;
+}
+
+static inline void
+retention_paths_record(struct retention_paths *paths, struct gc_ref ref,
+                       uintptr_t parent) {
+  pthread_mutex_lock(&paths->lock);
+  address_map_add(&paths->parents, gc_ref_value(ref), parent);
+  pthread_mutex_unlock(&paths->lock);
+}
+
+static const char*
+retention_root_kind_name(enum gc_root_kind kind) {
+  switch (kind) {
+  case GC_ROOT_KIND_HEAP:
+    return "heap roots";
+  case GC_ROOT_KIND_MUTATOR:
+    return "mutator roots";
+  case GC_ROOT_KIND_CONSERVATIVE_EDGES:
+  case GC_ROOT_KIND_CONSERVATIVE_POSSIBLY_INTERIOR_EDGES:
+    return "conservative roots";
+  case GC_ROOT_KIND_RESOLVED_EPHEMERONS:
+    return "ephemerons";
+  case GC_ROOT_KIND_EDGE:
+    return "edge roots";
+  case GC_ROOT_KIND_EDGE_BUFFER:
+    return "remembered set";
+  case GC_ROOT_KIND_MARKED_OBJECTS:
+    return "promoted objects";
+  default:
+    return "unknown";
+  }
+}
+
+struct retention_path_count {
+  const char *kind;
+  char *path;
+  size_t count;
+  size_t kind_count;
+};
+
+struct retention_report {
+  struct retention_paths *paths;
+  struct retention_path_count *counts;
+  size_t count_count;
+  size_t count_capacity;
+  size_t stride;
+  size_t seen;
+  size_t sampled;
+};
+
+// Render the path from the root down to OBJ, collapsing runs of objects
+// of the same kind into "Kind+" and eliding all but the
+// RETENTION_PATHS_MAX_KINDS kinds nearest to OBJ.
+static void
+retention_paths_describe(struct retention_paths *paths, struct gc_ref obj,
+                         char *buf, size_t len) {
+  const char *kinds[RETENTION_PATHS_MAX_KINDS];
+  int repeated[RETENTION_PATHS_MAX_KINDS];
+  size_t kind_count = 0;
+  int elided = 0;
+  const char *root = "deep chain";
+
+  uintptr_t addr = gc_ref_value(obj);
+  for (size_t depth = 0; depth < RETENTION_PATHS_MAX_DEPTH; depth++) {
+    const char *kind = gc_object_kind_name(gc_ref(addr));
+    if (kind_count && strcmp(kinds[kind_count - 1], kind) == 0)
+      repeated[kind_count - 1] = 1;
+    else if (kind_count < RETENTION_PATHS_MAX_KINDS) {
+      kinds[kind_count] = kind;
+      repeated[kind_count++] = 0;
+    } else
+      elided = 1;
+    uintptr_t parent = address_map_lookup(&paths->parents, addr,
+                                          GC_ROOT_KIND_NONE);
+    if (retention_parent_is_root(parent)) {
+      root = retention_root_kind_name(parent);
+      break;
+    }
+    addr = parent;
+  }
+
+  size_t pos = snprintf(buf, len, "%s%s", root, elided ? " > ..." : "");
+  while (kind_count-- && pos < len)
+    pos += snprintf(buf + pos, len - pos, " > %s%s", kinds[kind_count],
+                    repeated[kind_count] ? "+" : "");
+}
+
+static void
+retention_report_add(struct retention_report *report, const char *kind,
+                     const char *path) {
+  for (size_t i = 0; i < report->count_count; i++) {
+    struct retention_path_count *c = &report->counts[i];
+    if (strcmp(c->kind, kind) == 0 && strcmp(c->path, path) == 0) {
+      c->count++;
+      return;
+    }
+  }
+  if (report->count_count == report->count_capacity) {
+    size_t capacity = report->count_capacity ? report->count_capacity * 2 : 64;
+    struct retention_path_count *counts =
+      realloc(report->counts, capacity * sizeof(*counts));
+    if (!counts)
+      return;
+    report->counts = counts;
+    report->count_capacity = capacity;
+  }
+  char *copy = strdup(path);
+  if (!copy)
+    return;
+  report->counts[report->count_count++] =
+    (struct retention_path_count){ kind, copy, 1, 0 };
+}
+
+static void
+retention_report_visit(uintptr_t addr, uintptr_t parent, void *data) {
+  struct retention_report *report = data;
+  if (report->seen++ % report->stride)
+    return;
+  report->sampled++;
+  struct gc_ref ref = gc_ref(addr);
+  char path[256];
+  retention_paths_describe(report->paths, ref, path, sizeof(path));
+  retention_report_add(report, gc_object_kind_name(ref), path);
+}
+
+static int
+retention_path_count_compare(const void *a, const void *b) {
+  const struct retention_path_count *x = a, *y = b;
+  if (x->kind_count != y->kind_count)
+    return x->kind_count < y->kind_count ? 1 : -1;
+  int cmp = strcmp(x->kind, y->kind);
+  if (cmp)
+    return cmp;
+  if (x->count != y->count)
+    return x->count < y->count ? 1 : -1;
+  return strcmp(x->path, y->path);
+}
+
+// Stop recording, print a summary of the dominant retention paths to F,
+// and release the recorded parents.
+static void
+retention_paths_finish(struct retention_paths *paths, FILE *f,
+                       long gc_count) {
+  paths->recording = 0;
+  size_t live = paths->parents.hash_map.n_items;
+  size_t stride = live / RETENTION_PATHS_SAMPLE_COUNT;
+  struct retention_report report = { paths, NULL, 0, 0, stride ? stride : 1 };
+  address_map_for_each(&paths->parents, retention_report_visit, &report);
+
+  for (size_t i = 0; i < report.count_count; i++)
+    for (size_t j = 0; j < report.count_count; j++)
+      if (strcmp(report.counts[i].kind, report.counts[j].kind) == 0)
+        report.counts[i].kind_count += report.counts[j].count;
+  qsort(report.counts, report.count_count, sizeof(*report.counts),
+        retention_path_count_compare);
+
+  fprintf(f, "Retention paths at collection %ld: %zu live objects, "
+          "%zu sampled.\n", gc_count, live, report.sampled);
+  size_t kinds_printed = 0, paths_printed = 0;
+  for (size_t i = 0; i < report.count_count; i++) {
+    struct retention_path_count *c = &report.counts[i];
+    if (i == 0 || strcmp(c->kind, report.counts[i - 1].kind) != 0) {
+      if (kinds_printed++ == RETENTION_PATHS_PRINT_KINDS)
+        break;
+      paths_printed = 0;
+      fprintf(f, "  %s: %.1f%% of live objects\n", c->kind,
+              100.0 * c->kind_count / report.sampled);
+    }
+    if (paths_printed++ < RETENTION_PATHS_PRINT_PATHS_PER_KIND)
+      fprintf(f, "    %5.1f%%  %s\n", 100.0 * c->count / report.sampled,
+              c->path);
+  }
+
+  for (size_t i = 0; i < report.count_count; i++)
+    free(report.counts[i].path);
+  free(report.counts);
+  // The map can be large; give its memory back.
+  address_map_destroy(&paths->parents);
+  address_map_init(&paths->parents);
+}
+
+#endif // RETENTION_PATHS_H
@@ -18,6 +18,8 @@ enum gc_root_kind {
   GC_ROOT_KIND_RESOLVED_EPHEMERONS,
   GC_ROOT_KIND_EDGE,
   GC_ROOT_KIND_EDGE_BUFFER,
+  GC_ROOT_KIND_MARKED_OBJECTS,
+  GC_ROOT_KIND_EPHEMERON_SWEEP,
 };
 
 struct gc_root {
@@ -29,6 +31,7 @@ struct gc_root {
     struct extent_range range;
     struct gc_edge edge;
     struct gc_edge_buffer *edge_buffer;
+    struct { size_t index; size_t count; } shard;
   };
 };
 
@@ -78,4 +81,23 @@ gc_root_edge_buffer(struct gc_edge_buffer *buf) {
   return ret;
 }
 
+// Trace the objects in [LO_ADDR, HI_ADDR) that are already marked.
+static inline struct gc_root
+gc_root_marked_objects(uintptr_t lo_addr, uintptr_t hi_addr) {
+  struct gc_root ret = { GC_ROOT_KIND_MARKED_OBJECTS };
+  ret.range = (struct extent_range) {lo_addr, hi_addr};
+  return ret;
+}
+
+// Not a root as such: sweep shard INDEX of COUNT of the pending
+// ephemeron table once tracing is done.  Adding the shards as roots of
+// a roots-only trace spreads the sweep over the trace workers.
+static inline struct gc_root
+gc_root_ephemeron_sweep(size_t index, size_t count) {
+  struct gc_root ret = { GC_ROOT_KIND_EPHEMERON_SWEEP };
+  ret.shard.index = index;
+  ret.shard.count = count;
+  return ret;
+}
+
 #endif // ROOT_H
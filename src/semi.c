@@ -60,9 +60,11 @@ struct gc_mutator {
 };
 
 #define HEAP_EVENT(heap, event, ...)                                    \
-  (heap)->event_listener.event((heap)->event_listener_data, ##__VA_ARGS__)
-#define MUTATOR_EVENT(mut, event, ...)                                  \
-  (mut)->heap->event_listener.event((mut)->event_listener_data, ##__VA_ARGS__)
+  GC_HEAP_EVENT((heap)->event_listener, (heap)->event_listener_data,    \
+                event, ##__VA_ARGS__)
+#define MUTATOR_EVENT(mut, event)                                       \
+  GC_MUTATOR_EVENT((mut)->heap->event_listener, (mut),                  \
+                   (mut)->event_listener_data, event)
 
 static inline void clear_memory(uintptr_t addr, size_t size) {
   memset((char*)addr, 0, size);
@@ -91,6 +93,13 @@ uintptr_t gc_small_object_nursery_high_address(struct gc_heap *heap) {
   GC_CRASH();
 }
 
+uint64_t gc_mutator_allocated_bytes(struct gc_mutator *mut) {
+  // Per-mutator allocation accounting is not implemented.
+  return 0;
+}
+void gc_mutator_set_allocation_quota(struct gc_mutator *mut, uint64_t bytes) {
+}
+
 static uintptr_t align_up(uintptr_t addr, size_t align) {
   return (addr + align - 1) & ~(align-1);
 }
@@ -501,6 +510,7 @@ static void* allocate_large(struct gc_mutator *mut, size_t size) {
 }
 
 void* gc_allocate_slow(struct gc_mutator *mut, size_t size) {
+  GC_PROBE(allocate_slow, mut, size);
   if (size > gc_allocator_large_threshold())
     return allocate_large(mut, size);
 
@@ -692,8 +702,7 @@ int gc_init(const struct gc_options *options, struct gc_stack_addr *stack_base,
   // Ignore stack base, as we are precise.
   (*mut)->roots = NULL;
 
-  (*mut)->event_listener_data =
-    event_listener.mutator_added(event_listener_data);
+  (*mut)->event_listener_data = HEAP_EVENT(*heap, mutator_added);
 
   return 1;
 }
@@ -29,7 +29,8 @@ gc_trace_worker_data(struct gc_trace_worker *worker) {
 
 static int
 gc_tracer_init(struct gc_tracer *tracer, struct gc_heap *heap,
-               size_t parallelism) {
+               size_t parallelism, double idle_timeout,
+               unsigned worklist_max_log_size) {
   tracer->heap = heap;
   tracer->trace_roots_only = 0;
   root_worklist_init(&tracer->roots);
@@ -45,6 +46,11 @@ gc_tracer_add_root(struct gc_tracer *tracer, struct gc_root root) {
   root_worklist_push(&tracer->roots, root);
 }
 
+static inline size_t
+gc_tracer_worker_count(struct gc_tracer *tracer) {
+  return 1;
+}
+
 static inline void
 gc_trace_worker_enqueue(struct gc_trace_worker *worker, struct gc_ref ref) {
   simple_worklist_push(&worker->tracer->worklist, ref);
@@ -64,7 +70,8 @@ tracer_trace_with_data(struct gc_tracer *tracer, struct gc_heap *heap,
   root_worklist_reset(&tracer->roots);
   if (!tracer->trace_roots_only) {
     do {
-      struct gc_ref obj = simple_worklist_pop(&tracer->worklist);
+      // LIFO order, for approximately depth-first evacuation.
+      struct gc_ref obj = simple_worklist_pop_newest(&tracer->worklist);
       if (gc_ref_is_null(obj))
         break;
       trace_one(obj, heap, worker);
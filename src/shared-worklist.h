@@ -4,6 +4,7 @@
 #include <stdatomic.h>
 
 #include "assert.h"
+#include "compressed-ref.h"
 #include "debug.h"
 #include "gc-align.h"
 #include "gc-inline.h"
@@ -20,12 +21,12 @@
 struct shared_worklist_buf {
   unsigned log_size;
   size_t size;
-  uintptr_t *data;
+  uint32_t *data;
 };
 
-// Min size: 8 kB on 64-bit systems, 4 kB on 32-bit.
+// Entries are compressed refs.  Min size: 4 kB.
 #define shared_worklist_buf_min_log_size ((unsigned) 10)
-// Max size: 2 GB on 64-bit systems, 1 GB on 32-bit.
+// Max size: 1 GB.
 #define shared_worklist_buf_max_log_size ((unsigned) 28)
 
 static const size_t shared_worklist_release_byte_threshold = 256 * 1024;
@@ -34,7 +35,7 @@ static int
 shared_worklist_buf_init(struct shared_worklist_buf *buf, unsigned log_size) {
   ASSERT(log_size >= shared_worklist_buf_min_log_size);
   ASSERT(log_size <= shared_worklist_buf_max_log_size);
-  size_t size = (1 << log_size) * sizeof(uintptr_t);
+  size_t size = (1 << log_size) * sizeof(uint32_t);
   void *mem = gc_platform_acquire_memory(size, 0);
   if (!mem) {
     perror("Failed to grow work-stealing dequeue");
@@ -54,7 +55,7 @@ shared_worklist_buf_size(struct shared_worklist_buf *buf) {
 
 static inline size_t
 shared_worklist_buf_byte_size(struct shared_worklist_buf *buf) {
-  return shared_worklist_buf_size(buf) * sizeof(uintptr_t);
+  return shared_worklist_buf_size(buf) * sizeof(uint32_t);
 }
 
 static void
@@ -74,17 +75,17 @@ shared_worklist_buf_destroy(struct shared_worklist_buf *buf) {
   }
 }
 
-static inline struct gc_ref
+static inline struct compressed_ref
 shared_worklist_buf_get(struct shared_worklist_buf *buf, size_t i) {
-  return gc_ref(atomic_load_explicit(&buf->data[i & (buf->size - 1)],
-                                     memory_order_relaxed));
+  return compressed_ref(atomic_load_explicit(&buf->data[i & (buf->size - 1)],
+                                             memory_order_relaxed));
 }
 
 static inline void
 shared_worklist_buf_put(struct shared_worklist_buf *buf, size_t i,
-                        struct gc_ref ref) {
+                        struct compressed_ref ref) {
   return atomic_store_explicit(&buf->data[i & (buf->size - 1)],
-                               gc_ref_value(ref),
+                               ref.offset,
                                memory_order_relaxed);
 }
 
@@ -160,7 +161,7 @@ shared_worklist_grow(struct shared_worklist *q, int cur, size_t b, size_t t) {
 }
 
 static void
-shared_worklist_push(struct shared_worklist *q, struct gc_ref x) {
+shared_worklist_push(struct shared_worklist *q, struct compressed_ref x) {
   size_t b = LOAD_RELAXED(&q->bottom);
   size_t t = LOAD_ACQUIRE(&q->top);
   int active = LOAD_RELAXED(&q->active);
@@ -174,31 +175,39 @@ shared_worklist_push(struct shared_worklist *q, struct gc_ref x) {
   STORE_RELAXED(&q->bottom, b + 1);
 }
 
-static void
-shared_worklist_push_many(struct shared_worklist *q, struct gc_ref *objv,
-                          size_t count) {
+// Push up to COUNT objects, growing the deque as needed but not beyond
+// 2^MAX_LOG_SIZE entries.  Return the number of objects pushed.
+static size_t
+shared_worklist_push_many(struct shared_worklist *q,
+                          struct compressed_ref *objv, size_t count,
+                          unsigned max_log_size) {
   size_t b = LOAD_RELAXED(&q->bottom);
   size_t t = LOAD_ACQUIRE(&q->top);
   int active = LOAD_RELAXED(&q->active);
 
-  ssize_t size = b - t;
-  while (size > shared_worklist_buf_size(&q->bufs[active]) - count)
+  size_t size = b - t;
+  while (size + count > shared_worklist_buf_size(&q->bufs[active])
+         && q->bufs[active].log_size < max_log_size)
     active = shared_worklist_grow(q, active, b, t); /* Full queue; grow. */
 
+  size_t avail = shared_worklist_buf_size(&q->bufs[active]) - size;
+  if (count > avail)
+    count = avail;
   for (size_t i = 0; i < count; i++)
     shared_worklist_buf_put(&q->bufs[active], b + i, objv[i]);
   atomic_thread_fence(memory_order_release);
   STORE_RELAXED(&q->bottom, b + count);
+  return count;
 }
 
-static struct gc_ref
+static struct compressed_ref
 shared_worklist_try_pop(struct shared_worklist *q) {
   size_t b = LOAD_RELAXED(&q->bottom);
   int active = LOAD_RELAXED(&q->active);
   STORE_RELAXED(&q->bottom, b - 1);
   atomic_thread_fence(memory_order_seq_cst);
   size_t t = LOAD_RELAXED(&q->top);
-  struct gc_ref x;
+  struct compressed_ref x;
   ssize_t size = b - t;
   if (size > 0) { // Non-empty queue.
     x = shared_worklist_buf_get(&q->bufs[active], b - 1);
@@ -207,17 +216,17 @@ shared_worklist_try_pop(struct shared_worklist *q) {
                                                    memory_order_seq_cst,
                                                    memory_order_relaxed))
         // Failed race.
-        x = gc_ref_null();
+        x = compressed_ref_null();
       STORE_RELAXED(&q->bottom, b);
     }
   } else { // Empty queue.
-    x = gc_ref_null();
+    x = compressed_ref_null();
     STORE_RELAXED(&q->bottom, b);
   }
   return x;
 }
 
-static struct gc_ref
+static struct compressed_ref
 shared_worklist_steal(struct shared_worklist *q) {
   while (1) {
     size_t t = LOAD_ACQUIRE(&q->top);
@@ -225,9 +234,9 @@ shared_worklist_steal(struct shared_worklist *q) {
     size_t b = LOAD_ACQUIRE(&q->bottom);
     ssize_t size = b - t;
     if (size <= 0)
-      return gc_ref_null();
+      return compressed_ref_null();
     int active = LOAD_CONSUME(&q->active);
-    struct gc_ref ref = shared_worklist_buf_get(&q->bufs[active], t);
+    struct compressed_ref ref = shared_worklist_buf_get(&q->bufs[active], t);
     if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
                                                  memory_order_seq_cst,
                                                  memory_order_relaxed))
@@ -97,6 +97,11 @@ simple_worklist_push_many(struct simple_worklist *q, struct gc_ref *pv,
     simple_worklist_put(q, q->write++, pv[i]);
 }
 
+static inline int
+simple_worklist_empty(struct simple_worklist *q) {
+  return q->read == q->write;
+}
+
 static inline struct gc_ref
 simple_worklist_pop(struct simple_worklist *q) {
   if (UNLIKELY(q->read == q->write))
@@ -104,6 +109,14 @@ simple_worklist_pop(struct simple_worklist *q) {
   return simple_worklist_get(q, q->read++);
 }
 
+// Pop the most recently pushed entry.
+static inline struct gc_ref
+simple_worklist_pop_newest(struct simple_worklist *q) {
+  if (UNLIKELY(q->read == q->write))
+    return gc_ref_null();
+  return simple_worklist_get(q, --q->write);
+}
+
 static void
 simple_worklist_release(struct simple_worklist *q) {
   size_t byte_size = q->size * sizeof(struct gc_ref);
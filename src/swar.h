@@ -26,6 +26,24 @@ load_eight_aligned_bytes(uint8_t *ptr) {
   return word;
 }
 
+// Return a word with the high bit set in each byte of BYTES that is
+// equal to BYTE.  Bytes equal to BYTE ^ 1 may also be flagged, if they
+// are more significant than a true match; callers must either check
+// candidates or know that such bytes can't occur.
+static inline uint64_t
+match_bytes_against_byte(uint64_t bytes, uint8_t byte) {
+  uint64_t x = bytes ^ broadcast_byte(byte);
+  return (x - broadcast_byte(0x01)) & ~x & broadcast_byte(0x80);
+}
+
+// Collect the high bits of each byte of BYTES into the low 8 bits of
+// the result, with the least significant byte going to bit 0.
+static inline unsigned
+pack_high_bits(uint64_t bytes) {
+  bytes &= broadcast_byte(0x80);
+  return ((bytes >> 7) * 0x0102040810204080ULL) >> 56;
+}
+
 static size_t
 scan_for_byte(uint8_t *ptr, size_t limit, uint64_t mask) {
   size_t n = 0;
@@ -3,6 +3,7 @@
 
 #include "gc-ref.h"
 #include "gc-edge.h"
+#include "extents.h"
 #include "root.h"
 
 struct gc_heap;
@@ -32,13 +33,32 @@ gc_trace_worker_call_with_data(void (*f)(struct gc_tracer *tracer,
                                struct gc_heap *heap,
                                struct gc_trace_worker *worker);
 
+// Return the range of addresses in which most traced objects lie.  The
+// tracer may use this to represent enqueued objects more compactly.
+static inline struct extent_range
+gc_trace_compressible_range(struct gc_heap *heap);
+
+// Return nonzero if the collector can enumerate marked objects by
+// address.  If so, the tracer may bound the size of its worklists, and
+// recover from overflow by calling gc_trace_rescan_range, which should
+// call trace_one on each object marked during this trace whose start
+// lies in [lo, hi).
+static inline int gc_trace_can_rescan(struct gc_heap *heap);
+static void gc_trace_rescan_range(struct gc_heap *heap,
+                                  struct gc_trace_worker *worker,
+                                  uintptr_t lo, uintptr_t hi);
+
 ////////////////////////////////////////////////////////////////////////
 /// To be implemented by tracer.
 ////////////////////////////////////////////////////////////////////////
 
-// Initialize the tracer when the heap is created.
+// Initialize the tracer when the heap is created.  Parallel tracers
+// start helper threads on demand, and let them exit after IDLE_TIMEOUT
+// seconds without work.  If the collector can rescan, parallel tracers
+// bound each shared worklist to 2^WORKLIST_MAX_LOG_SIZE entries.
 static int gc_tracer_init(struct gc_tracer *tracer, struct gc_heap *heap,
-                          size_t parallelism);
+                          size_t parallelism, double idle_timeout,
+                          unsigned worklist_max_log_size);
 
 // Initialize the tracer for a new GC cycle.
 static void gc_tracer_prepare(struct gc_tracer *tracer);
@@ -56,6 +76,9 @@ static inline void gc_trace_worker_enqueue(struct gc_trace_worker *worker,
 static inline struct gc_trace_worker_data*
 gc_trace_worker_data(struct gc_trace_worker *worker) GC_ALWAYS_INLINE;
 
+// Return the number of workers that may process roots in parallel.
+static inline size_t gc_tracer_worker_count(struct gc_tracer *tracer);
+
 // Just trace roots.
 static inline void gc_tracer_trace_roots(struct gc_tracer *tracer);
 
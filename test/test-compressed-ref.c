@@ -0,0 +1,124 @@
+#include <stdio.h>
+
+#include "compressed-ref.h"
+
+#define GRANULE 16
+#define LO ((uintptr_t)0x10000000)
+#define HI (LO + 64 * 1024 * 1024)
+
+static int failures = 0;
+
+static void check(int ok, const char *what, uintptr_t addr) {
+  if (!ok) {
+    fprintf(stdout, "failed: %s at %p\n", what, (void*)addr);
+    failures++;
+  }
+}
+
+static void check_round_trip(const struct ref_compressor *c, uintptr_t addr,
+                             uint32_t expected) {
+  struct gc_ref ref = gc_ref(addr);
+  check(ref_compressor_can_compress(c, ref), "compressible", addr);
+  if (!ref_compressor_can_compress(c, ref))
+    return;
+  struct compressed_ref compressed = ref_compressor_compress(c, ref);
+  check(compressed.offset == expected, "compressed offset", addr);
+  check(!compressed_ref_is_null(compressed), "not null", addr);
+  check(gc_ref_value(ref_compressor_decompress(c, compressed)) == addr,
+        "round trip", addr);
+}
+
+static void check_uncompressible(const struct ref_compressor *c,
+                                 uintptr_t addr) {
+  check(!ref_compressor_can_compress(c, gc_ref(addr)), "uncompressible",
+        addr);
+}
+
+int main(int argc, char *arv[]) {
+  struct ref_compressor c;
+
+  // The null reference is offset 0, whatever the window.
+  check(compressed_ref_is_null(compressed_ref_null()), "null is null", 0);
+  ref_compressor_reset(&c);
+  check(gc_ref_is_null(ref_compressor_decompress(&c, compressed_ref_null())),
+        "null decompresses to null", 0);
+
+  // A reset compressor compresses nothing.
+  check_uncompressible(&c, 0);
+  check_uncompressible(&c, LO);
+  check_uncompressible(&c, UINTPTR_MAX & ~(uintptr_t)(GRANULE - 1));
+
+  // The window covers [lo, hi), with its base one granule below lo so
+  // that lo itself is offset 1.
+  ref_compressor_init(&c, (struct extent_range){LO, HI}, GRANULE);
+  check(c.base == LO - GRANULE, "base is one granule below lo", c.base);
+  check(gc_ref_is_null(ref_compressor_decompress(&c, compressed_ref_null())),
+        "null decompresses to null", 0);
+  check_round_trip(&c, LO, 1);
+  check_round_trip(&c, LO + GRANULE, 2);
+  check_round_trip(&c, HI - GRANULE, (HI - LO) / GRANULE);
+  check_uncompressible(&c, 0);
+  check_uncompressible(&c, LO - GRANULE);
+  check_uncompressible(&c, LO - 2 * GRANULE);
+  check_uncompressible(&c, LO - 8);
+  check_uncompressible(&c, LO + 8);
+  check_uncompressible(&c, HI);
+  check_uncompressible(&c, HI + GRANULE);
+
+  // Empty and inverted ranges, and ranges whose base would be below
+  // zero, compress nothing.
+  ref_compressor_init(&c, (struct extent_range){LO, LO}, GRANULE);
+  check_uncompressible(&c, LO);
+  ref_compressor_init(&c, (struct extent_range){HI, LO}, GRANULE);
+  check_uncompressible(&c, LO);
+  check_uncompressible(&c, HI);
+  ref_compressor_init(&c, (struct extent_range){0, HI}, GRANULE);
+  check_uncompressible(&c, 0);
+  check_uncompressible(&c, LO);
+  ref_compressor_init(&c, (struct extent_range){GRANULE, HI}, GRANULE);
+  check(c.base == 0, "base of a range starting at one granule", c.base);
+  check_uncompressible(&c, 0);
+  check_round_trip(&c, GRANULE, 1);
+
+  // Smaller granules have a smaller window, with the same encoding.
+  ref_compressor_init(&c, (struct extent_range){LO, HI}, 8);
+  check(c.base == LO - 8, "base with 8-byte granules", c.base);
+  check_round_trip(&c, LO, 1);
+  check_round_trip(&c, LO + 8, 2);
+  check_uncompressible(&c, LO - 8);
+  check_uncompressible(&c, LO + 4);
+
+  if (sizeof(uintptr_t) > sizeof(uint32_t)) {
+    // A range larger than 32-bit offsets can span is clipped at the top,
+    // so that no reference wraps around to the null offset or aliases
+    // another.
+    uintptr_t max_span = ref_compressor_max_span(GRANULE);
+    check(max_span == (uintptr_t)UINT32_MAX * GRANULE, "max span", max_span);
+    uintptr_t lo = (uintptr_t)1 << 40;
+    uintptr_t hi = lo + 2 * max_span;
+    ref_compressor_init(&c, (struct extent_range){lo, hi}, GRANULE);
+    check(c.span == max_span, "span clipped to max", c.span);
+    uintptr_t last = c.base + max_span - GRANULE;
+    check_round_trip(&c, lo, 1);
+    check_round_trip(&c, last, UINT32_MAX - 1);
+    check_uncompressible(&c, last + GRANULE);
+    check_uncompressible(&c, c.base + ((uintptr_t)1 << 32) * GRANULE);
+    check_uncompressible(&c, c.base + ((uintptr_t)1 << 32) * GRANULE
+                             + GRANULE);
+    check_uncompressible(&c, hi - GRANULE);
+
+    // A range that exactly fits is not clipped.
+    ref_compressor_init(&c, (struct extent_range){lo, lo + max_span - GRANULE},
+                        GRANULE);
+    check(c.span == max_span, "span of an exactly fitting range", c.span);
+    check_round_trip(&c, lo + max_span - 2 * GRANULE, UINT32_MAX - 1);
+    check_uncompressible(&c, lo + max_span - GRANULE);
+  }
+
+  if (failures) {
+    fprintf(stdout, "%d failures\n", failures);
+    return 1;
+  }
+  fprintf(stdout, "all compressed-ref checks passed\n");
+  return 0;
+}
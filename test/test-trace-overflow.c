@@ -0,0 +1,249 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GC_IMPL 1
+
+#include "gc-edge.h"
+#include "gc-ref.h"
+
+// Build with:
+//   gcc -O2 -DNDEBUG -Iapi -Isrc test/test-trace-overflow.c
+//     src/gc-platform-gnu-linux.c -lpthread
+//
+// A heap of fixed-size objects in one aligned arena, plus a few objects
+// outside it that the tracer can't compress.  Objects are marked when
+// they are enqueued, as in mmc.
+
+#define GRANULE 16
+#define EDGE_COUNT 3
+#define OBJECT_COUNT (1 << 20)
+#define OUTSIDE_COUNT 64
+#define ROOT_COUNT 16
+
+struct object {
+  atomic_uchar marked;
+  struct object *edges[EDGE_COUNT];
+};
+
+struct gc_heap {
+  struct object *objects;
+  struct object *outside;
+  struct object *roots[ROOT_COUNT];
+  atomic_size_t rescanned_ranges;
+};
+
+static inline size_t gc_allocator_small_granule_size(void) {
+  return GRANULE;
+}
+
+#include "parallel-tracer.h"
+
+static int try_mark(struct object *obj) {
+  return obj
+    && !atomic_exchange_explicit(&obj->marked, 1, memory_order_relaxed);
+}
+
+static inline void trace_one(struct gc_ref ref, struct gc_heap *heap,
+                             struct gc_trace_worker *worker) {
+  struct object *obj = gc_ref_heap_object(ref);
+  for (size_t i = 0; i < EDGE_COUNT; i++)
+    if (try_mark(obj->edges[i]))
+      gc_trace_worker_enqueue(worker, gc_ref_from_heap_object(obj->edges[i]));
+}
+
+static inline void trace_root(struct gc_root root, struct gc_heap *heap,
+                              struct gc_trace_worker *worker) {
+  GC_ASSERT_EQ(root.kind, GC_ROOT_KIND_EDGE);
+  struct object *obj = gc_ref_heap_object(gc_edge_ref(root.edge));
+  if (try_mark(obj))
+    gc_trace_worker_enqueue(worker, gc_ref_from_heap_object(obj));
+}
+
+static void
+gc_trace_worker_call_with_data(void (*f)(struct gc_tracer *tracer,
+                                         struct gc_heap *heap,
+                                         struct gc_trace_worker *worker,
+                                         struct gc_trace_worker_data *data),
+                               struct gc_tracer *tracer,
+                               struct gc_heap *heap,
+                               struct gc_trace_worker *worker) {
+  f(tracer, heap, worker, NULL);
+}
+
+static inline struct extent_range
+gc_trace_compressible_range(struct gc_heap *heap) {
+  return (struct extent_range){ (uintptr_t)heap->objects,
+                                (uintptr_t)(heap->objects + OBJECT_COUNT) };
+}
+
+static inline int gc_trace_can_rescan(struct gc_heap *heap) {
+  return 1;
+}
+
+static void gc_trace_rescan_range(struct gc_heap *heap,
+                                  struct gc_trace_worker *worker,
+                                  uintptr_t lo, uintptr_t hi) {
+  atomic_fetch_add(&heap->rescanned_ranges, 1);
+  uintptr_t base = (uintptr_t)heap->objects;
+  size_t start = (lo - base + sizeof(struct object) - 1) / sizeof(struct object);
+  size_t end = (hi - base + sizeof(struct object) - 1) / sizeof(struct object);
+  if (end > OBJECT_COUNT)
+    end = OBJECT_COUNT;
+  for (size_t i = start; i < end; i++)
+    if (atomic_load_explicit(&heap->objects[i].marked, memory_order_relaxed))
+      trace_one(gc_ref_from_heap_object(&heap->objects[i]), heap, worker);
+}
+
+static uint64_t random_state = 0x9e3779b97f4a7c15;
+static uint64_t next_random(void) {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+static struct object* random_edge(struct gc_heap *heap) {
+  uint64_t r = next_random();
+  if (r % 8 == 0)
+    return NULL;
+  if (r % 1024 == 1)
+    return &heap->outside[(r >> 10) % OUTSIDE_COUNT];
+  return &heap->objects[(r >> 10) % OBJECT_COUNT];
+}
+
+static void init_heap(struct gc_heap *heap) {
+  heap->objects = aligned_alloc(TRACE_OVERFLOW_REGION_SIZE,
+                                OBJECT_COUNT * sizeof(struct object));
+  heap->outside = calloc(OUTSIDE_COUNT, sizeof(struct object));
+  if (!heap->objects || !heap->outside) {
+    fprintf(stdout, "failed to allocate heap\n");
+    exit(1);
+  }
+  for (size_t i = 0; i < OBJECT_COUNT; i++)
+    for (size_t j = 0; j < EDGE_COUNT; j++)
+      heap->objects[i].edges[j] = random_edge(heap);
+  for (size_t i = 0; i < OUTSIDE_COUNT; i++)
+    for (size_t j = 0; j < EDGE_COUNT; j++)
+      heap->outside[i].edges[j] = random_edge(heap);
+  for (size_t i = 0; i < ROOT_COUNT; i++)
+    heap->roots[i] = random_edge(heap);
+  heap->roots[0] = &heap->outside[0];
+  atomic_init(&heap->rescanned_ranges, 0);
+}
+
+static void clear_marks(struct gc_heap *heap) {
+  for (size_t i = 0; i < OBJECT_COUNT; i++)
+    atomic_init(&heap->objects[i].marked, 0);
+  for (size_t i = 0; i < OUTSIDE_COUNT; i++)
+    atomic_init(&heap->outside[i].marked, 0);
+}
+
+// Compute the expected marks with a simple depth-first search.
+static size_t mark_reachable(struct gc_heap *heap, unsigned char *reachable,
+                             unsigned char *reachable_outside) {
+  struct object **stack =
+    malloc((OBJECT_COUNT + OUTSIDE_COUNT) * EDGE_COUNT
+           * sizeof(struct object*));
+  size_t size = 0, count = 0;
+  memset(reachable, 0, OBJECT_COUNT);
+  memset(reachable_outside, 0, OUTSIDE_COUNT);
+  for (size_t i = 0; i < ROOT_COUNT; i++)
+    if (heap->roots[i])
+      stack[size++] = heap->roots[i];
+  while (size) {
+    struct object *obj = stack[--size];
+    unsigned char *bit =
+      obj >= heap->objects && obj < heap->objects + OBJECT_COUNT
+      ? &reachable[obj - heap->objects]
+      : &reachable_outside[obj - heap->outside];
+    if (*bit)
+      continue;
+    *bit = 1;
+    count++;
+    for (size_t j = 0; j < EDGE_COUNT; j++)
+      if (obj->edges[j])
+        stack[size++] = obj->edges[j];
+  }
+  free(stack);
+  return count;
+}
+
+static int check_trace(struct gc_heap *heap, size_t parallelism,
+                       unsigned worklist_max_log_size, int expect_rescan,
+                       const unsigned char *reachable,
+                       const unsigned char *reachable_outside) {
+  // Tracers can't be destroyed, and idle helper threads outlive this
+  // function, so the tracer is never freed.
+  struct gc_tracer *tracer = calloc(1, sizeof(*tracer));
+  if (!tracer || !gc_tracer_init(tracer, heap, parallelism, 1.0,
+                                 worklist_max_log_size)) {
+    fprintf(stdout, "failed to init tracer\n");
+    return 1;
+  }
+
+  int failures = 0;
+  for (size_t trace = 0; trace < 3; trace++) {
+    clear_marks(heap);
+    atomic_store(&heap->rescanned_ranges, 0);
+    gc_tracer_prepare(tracer);
+    for (size_t i = 0; i < ROOT_COUNT; i++)
+      if (heap->roots[i])
+        gc_tracer_add_root(tracer,
+                           gc_root_edge(gc_edge(&heap->roots[i])));
+    gc_tracer_trace(tracer);
+    gc_tracer_release(tracer);
+
+    size_t missing = 0, extra = 0;
+    for (size_t i = 0; i < OBJECT_COUNT; i++) {
+      int marked = atomic_load(&heap->objects[i].marked);
+      missing += reachable[i] && !marked;
+      extra += marked && !reachable[i];
+    }
+    for (size_t i = 0; i < OUTSIDE_COUNT; i++) {
+      int marked = atomic_load(&heap->outside[i].marked);
+      missing += reachable_outside[i] && !marked;
+      extra += marked && !reachable_outside[i];
+    }
+    size_t rescanned = atomic_load(&heap->rescanned_ranges);
+    if (missing || extra || (rescanned != 0) != expect_rescan) {
+      fprintf(stdout,
+              "failed: %zu workers, max log size %u, trace %zu: "
+              "%zu missing, %zu extra, %zu ranges rescanned\n",
+              tracer->worker_count, worklist_max_log_size, trace,
+              missing, extra, rescanned);
+      failures++;
+    }
+  }
+  return failures;
+}
+
+int main(int argc, char *arv[]) {
+  static struct gc_heap heap;
+  static unsigned char reachable[OBJECT_COUNT];
+  static unsigned char reachable_outside[OUTSIDE_COUNT];
+  init_heap(&heap);
+  size_t count = mark_reachable(&heap, reachable, reachable_outside);
+  if (count < OBJECT_COUNT / 2) {
+    fprintf(stdout, "only %zu objects reachable\n", count);
+    return 1;
+  }
+
+  int failures = 0;
+  // With worklists large enough for the whole heap, nothing overflows.
+  failures += check_trace(&heap, 1, 28, 0, reachable, reachable_outside);
+  // With the smallest worklists, the trace has to recover from overflow
+  // by rescanning, with any number of workers.
+  failures += check_trace(&heap, 1, 10, 1, reachable, reachable_outside);
+  failures += check_trace(&heap, 4, 10, 1, reachable, reachable_outside);
+  failures += check_trace(&heap, 4, 12, 1, reachable, reachable_outside);
+
+  if (failures) {
+    fprintf(stdout, "%d failures\n", failures);
+    return 1;
+  }
+  fprintf(stdout, "all trace overflow checks passed: %zu objects traced\n",
+          count);
+  return 0;
+}